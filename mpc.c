@@ -1,5 +1,22 @@
+#if defined(__unix__) || defined(__APPLE__)
+#define MPC_MMAP
+#define MPC_THREADS
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L
+#endif
+#endif
+
 #include "mpc.h"
 
+#ifdef MPC_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef MPC_THREADS
+#include <pthread.h>
+#endif
+
 /*
 ** State Type
 */
@@ -37,43 +54,112 @@ static mpc_state_t mpc_state_new(void) {
 **
 ** The second is a File which is also somewhat
 ** easy. The contents are never loaded into
-** memory but backtracking can still be achieved
-** by seeking in the file at different positions.
+** memory all at once. Instead a window onto
+** the file is read in large blocks, and the
+** cursor indexes into it much like a String.
+** Moving past the window slides it forward,
+** keeping some of the old contents behind so
+** short backtracks stay inside it, and only
+** a backtrack further than that needs a seek.
 **
 ** The final mode is Pipe. This is the difficult
-** one. As we assume pipes cannot be seeked - and
-** only support a single character lookahead at
-** any point, when the input is marked for a
-** potential backtracking we start buffering any
-** input.
+** one. As we assume pipes cannot be seeked,
+** every character read from the pipe goes into
+** a ring buffer, and stays there for as long as
+** the input is marked for a potential
+** backtracking.
 **
 ** This means that if we are requested to seek
 ** back we can simply start reading from the
-** buffer instead of the input.
+** buffer instead of the input. Once the last
+** mark is released everything behind the
+** cursor is dropped from the buffer.
 **
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
 ** to parse for all input methods.
 **
+** Where the platform supports it, regular files
+** given by name are instead mapped read only
+** into memory. This is scanned just like a
+** String, except it is not null terminated so
+** the cursor is checked against its length.
+**
 */
 
 enum {
   MPC_INPUT_STRING = 0,
   MPC_INPUT_FILE   = 1,
-  MPC_INPUT_PIPE   = 2
+  MPC_INPUT_PIPE   = 2,
+  MPC_INPUT_MMAP   = 3
 };
 
 enum {
   MPC_INPUT_MARKS_MIN = 32
 };
 
+/*
+** Small allocations made while parsing come
+** from a pool held by the input. Blocks are
+** sized in classes of 16, 32, 64 and 128
+** bytes, each with its own stack of free
+** blocks. The stacks are kept apart from the
+** blocks themselves so handing one out never
+** waits on a load from cold memory. The
+** first slab of every class is carved from a
+** single arena, so telling which class a block
+** belongs to is a couple of compares. When a
+** class runs dry it gets a new slab twice the
+** size of its last, so the pool grows without
+** falling back to the system allocator.
+*/
+
+enum {
+  MPC_MEM_CLASSES = 4,
+  MPC_MEM_MIN     = 16,
+  MPC_MEM_MAX     = 128,
+  MPC_MEM_BLOCKS  = 64
+};
+
+typedef struct mpc_slab_t {
+  struct mpc_slab_t *next;
+  char *begin;
+  char *end;
+  int cls;
+} mpc_slab_t;
+
+enum {
+  MPC_INPUT_WINDOW      = 65536,
+  MPC_INPUT_WINDOW_KEEP = 16384
+};
+
+enum {
+  MPC_INPUT_RING_MIN = 256
+};
+
+/*
+** Results of `mpc_packrat` parsers are kept in
+** a table held by the input, keyed on the parser
+** and the position it ran from. Each key has a
+** single slot, so the table never grows past
+** its fixed size and a clash simply evicts the
+** older result.
+*/
+
 enum {
-  MPC_INPUT_MEM_NUM = 512
+  MPC_MEMO_SLOTS = 4096
 };
 
 typedef struct {
-  char mem[64];
-} mpc_mem_t;
+  const mpc_parser_t *p;
+  long pos;
+  char flags;
+  char ok;
+  char last;
+  mpc_state_t end;
+  mpc_val_t *x;
+  mpc_err_t *e;
+} mpc_memo_t;
 
 typedef struct {
 
@@ -84,6 +170,18 @@ typedef struct {
   char *string;
   char *buffer;
   FILE *file;
+  size_t length;
+
+  char *window;
+  long window_pos;
+  size_t window_len;
+  int window_eof;
+
+  long buffer_pos;
+  size_t buffer_head;
+  size_t buffer_len;
+  size_t buffer_cap;
+  int buffer_eof;
 
   int suppress;
   int backtrack;
@@ -94,12 +192,48 @@ typedef struct {
   char *lasts;
   char last;
 
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  mpc_memo_t *memo;
+
+  char *mem;
+  char *mem_bound[MPC_MEM_CLASSES];
+  void **mem_free[MPC_MEM_CLASSES];
+  size_t mem_free_num[MPC_MEM_CLASSES];
+  size_t mem_free_slots[MPC_MEM_CLASSES];
+  size_t mem_blocks[MPC_MEM_CLASSES];
+  mpc_slab_t *slabs;
+  char *slabs_lo;
+  char *slabs_hi;
 
 } mpc_input_t;
 
+static void mpc_mem_init(mpc_input_t *i, size_t blocks) {
+  int j;
+  i->mem = NULL;
+  i->slabs = NULL;
+  i->slabs_lo = NULL;
+  i->slabs_hi = NULL;
+  for (j = 0; j < MPC_MEM_CLASSES; j++) {
+    i->mem_bound[j] = NULL;
+    i->mem_free[j] = NULL;
+    i->mem_free_num[j] = 0;
+    i->mem_free_slots[j] = 0;
+    i->mem_blocks[j] = blocks ? blocks : MPC_MEM_BLOCKS;
+  }
+}
+
+static void mpc_mem_delete(mpc_input_t *i) {
+  int j;
+  mpc_slab_t *s;
+  for (j = 0; j < MPC_MEM_CLASSES; j++) { free(i->mem_free[j]); }
+  while (i->slabs) {
+    s = i->slabs;
+    i->slabs = s->next;
+    free(s->begin);
+    free(s);
+  }
+  free(i->mem);
+}
+
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
@@ -122,9 +256,9 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
+  i->memo = NULL;
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_mem_init(i, MPC_MEM_BLOCKS);
 
   return i;
 }
@@ -152,9 +286,9 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
+  i->memo = NULL;
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_mem_init(i, MPC_MEM_BLOCKS);
 
   return i;
 
@@ -174,6 +308,12 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->buffer = NULL;
   i->file = pipe;
 
+  i->buffer_pos = 0;
+  i->buffer_head = 0;
+  i->buffer_len = 0;
+  i->buffer_cap = 0;
+  i->buffer_eof = 0;
+
   i->suppress = 0;
   i->backtrack = 1;
   i->marks_num = 0;
@@ -181,9 +321,9 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
+  i->memo = NULL;
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_mem_init(i, MPC_MEM_BLOCKS);
 
   return i;
 
@@ -202,6 +342,64 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->buffer = NULL;
   i->file = file;
 
+  i->window = malloc(MPC_INPUT_WINDOW);
+  i->window_pos = 0;
+  i->window_len = 0;
+  i->window_eof = 0;
+
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->last = '\0';
+  i->memo = NULL;
+
+  mpc_mem_init(i, MPC_MEM_BLOCKS);
+
+  return i;
+}
+
+#ifdef MPC_MMAP
+
+static char *mpc_input_map(FILE *file, size_t *length) {
+
+  struct stat st;
+  void *m;
+
+  /* Only non-empty regular files can be mapped */
+  if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    return NULL;
+  }
+
+  m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  if (m == MAP_FAILED) { return NULL; }
+
+  *length = st.st_size;
+  return m;
+}
+
+static mpc_input_t *mpc_input_new_mmap(const char *filename, FILE *file) {
+
+  mpc_input_t *i;
+  size_t length;
+  char *m = mpc_input_map(file, &length);
+
+  if (m == NULL) { return NULL; }
+
+  i = malloc(sizeof(mpc_input_t));
+
+  i->filename = malloc(strlen(filename) + 1);
+  strcpy(i->filename, filename);
+  i->type = MPC_INPUT_MMAP;
+  i->state = mpc_state_new();
+
+  i->string = m;
+  i->buffer = NULL;
+  i->file = NULL;
+  i->length = length;
+
   i->suppress = 0;
   i->backtrack = 1;
   i->marks_num = 0;
@@ -209,49 +407,152 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
+  i->memo = NULL;
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  mpc_mem_init(i, MPC_MEM_BLOCKS);
 
   return i;
 }
 
+#endif
+
+/* Map a named file where possible, otherwise read it as a File */
+static mpc_input_t *mpc_input_new_contents(const char *filename, FILE *file) {
+#ifdef MPC_MMAP
+  mpc_input_t *i = mpc_input_new_mmap(filename, file);
+  if (i) { return i; }
+#endif
+  return mpc_input_new_file(filename, file);
+}
+
 static void mpc_input_delete(mpc_input_t *i) {
 
   free(i->filename);
 
   if (i->type == MPC_INPUT_STRING) { free(i->string); }
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
+  if (i->type == MPC_INPUT_FILE) { free(i->window); }
+#ifdef MPC_MMAP
+  if (i->type == MPC_INPUT_MMAP) { munmap(i->string, i->length); }
+#endif
 
+  mpc_mem_delete(i);
   free(i->marks);
   free(i->lasts);
+  free(i->memo);
   free(i);
 }
 
-static int mpc_mem_ptr(mpc_input_t *i, void *p) {
-  return
-    (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+static size_t mpc_mem_size(int cls) {
+  return (size_t)MPC_MEM_MIN << cls;
 }
 
-static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
-
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
-
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
+/* The size class of "p", or -1 when it was not allocated from the pool */
+static int mpc_mem_class(mpc_input_t *i, void *p) {
+
+  int cls;
+  mpc_slab_t *s;
+
+  if ((char*)p >= i->mem && (char*)p < i->mem_bound[MPC_MEM_CLASSES-1]) {
+    for (cls = 0; (char*)p >= i->mem_bound[cls]; cls++);
+    return cls;
+  }
+
+  if ((char*)p < i->slabs_lo || (char*)p >= i->slabs_hi) { return -1; }
+  for (s = i->slabs; s; s = s->next) {
+    if ((char*)p >= s->begin && (char*)p < s->end) { return s->cls; }
+  }
+  return -1;
+}
+
+static void mpc_mem_push(mpc_input_t *i, int cls, char *begin, size_t n) {
+  size_t j, size = mpc_mem_size(cls);
+  /* Push in reverse so the first block is handed out first */
+  for (j = n; j > 0; j--) {
+    i->mem_free[cls][i->mem_free_num[cls]++] = begin + (j-1) * size;
+  }
+}
+
+/* Room for every block of the class, so mpc_free never has to grow it */
+static void mpc_mem_reserve(mpc_input_t *i, int cls, size_t n) {
+  i->mem_free_slots[cls] += n;
+  i->mem_free[cls] = realloc(i->mem_free[cls], sizeof(void*) * i->mem_free_slots[cls]);
+}
+
+static void mpc_mem_arena(mpc_input_t *i) {
+
+  int cls;
+  size_t total = 0;
+  char *begin;
+
+  for (cls = 0; cls < MPC_MEM_CLASSES; cls++) {
+    total += mpc_mem_size(cls) * i->mem_blocks[cls];
+  }
+
+  i->mem = begin = malloc(total);
+  for (cls = 0; cls < MPC_MEM_CLASSES; cls++) {
+    mpc_mem_reserve(i, cls, i->mem_blocks[cls]);
+    mpc_mem_push(i, cls, begin, i->mem_blocks[cls]);
+    begin += mpc_mem_size(cls) * i->mem_blocks[cls];
+    i->mem_bound[cls] = begin;
+    i->mem_blocks[cls] *= 2;
+  }
+}
+
+static void mpc_mem_grow(mpc_input_t *i, int cls) {
+
+  size_t size = mpc_mem_size(cls), n = i->mem_blocks[cls];
+  mpc_slab_t *s = malloc(sizeof(mpc_slab_t));
+
+  s->begin = malloc(size * n);
+  s->end = s->begin + size * n;
+  s->cls = cls;
+  s->next = i->slabs;
+  i->slabs = s;
+  i->mem_blocks[cls] = n * 2;
+
+  if (i->slabs_lo == NULL || s->begin < i->slabs_lo) { i->slabs_lo = s->begin; }
+  if (i->slabs_hi == NULL || s->end   > i->slabs_hi) { i->slabs_hi = s->end; }
+
+  mpc_mem_reserve(i, cls, n);
+  mpc_mem_push(i, cls, s->begin, n);
+}
+
+/* Hand every block back to its class, whatever the last parse left out */
+static void mpc_mem_reset(mpc_input_t *i) {
+
+  int cls;
+  size_t size;
+  char *begin = i->mem;
+  mpc_slab_t *s;
+
+  if (i->mem == NULL) { return; }
+
+  for (cls = 0; cls < MPC_MEM_CLASSES; cls++) {
+    size = mpc_mem_size(cls);
+    if (i->mem_free_num[cls] != i->mem_free_slots[cls]) {
+      i->mem_free_num[cls] = 0;
+      mpc_mem_push(i, cls, begin, (i->mem_bound[cls] - begin) / size);
+      for (s = i->slabs; s; s = s->next) {
+        if (s->cls == cls) { mpc_mem_push(i, cls, s->begin, (s->end - s->begin) / size); }
+      }
     }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+    begin = i->mem_bound[cls];
+  }
+}
 
-  return malloc(n);
+static void *mpc_malloc(mpc_input_t *i, size_t n) {
+
+  int cls = 0;
+
+  if (n > MPC_MEM_MAX) { return malloc(n); }
+  while (mpc_mem_size(cls) < n) { cls++; }
+
+  if (i->mem_free_num[cls] == 0) {
+    if (i->mem == NULL) { mpc_mem_arena(i); } else { mpc_mem_grow(i, cls); }
+  }
+
+  return i->mem_free[cls][--i->mem_free_num[cls]];
 }
 
 static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
@@ -261,21 +562,21 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
-  if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  int cls = mpc_mem_class(i, p);
+  if (cls < 0) { free(p); return; }
+  i->mem_free[cls][i->mem_free_num[cls]++] = p;
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 
   char *q = NULL;
+  int cls = mpc_mem_class(i, p);
 
-  if (!mpc_mem_ptr(i, p)) { return realloc(p, n); }
+  if (cls < 0) { return realloc(p, n); }
 
-  if (n > sizeof(mpc_mem_t)) {
-    q = malloc(n);
-    memcpy(q, p, sizeof(mpc_mem_t));
+  if (n > mpc_mem_size(cls)) {
+    q = mpc_malloc(i, n);
+    memcpy(q, p, mpc_mem_size(cls));
     mpc_free(i, p);
     return q;
   }
@@ -285,9 +586,10 @@ static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
 
 static void *mpc_export(mpc_input_t *i, void *p) {
   char *q = NULL;
-  if (!mpc_mem_ptr(i, p)) { return p; }
-  q = malloc(sizeof(mpc_mem_t));
-  memcpy(q, p, sizeof(mpc_mem_t));
+  int cls = mpc_mem_class(i, p);
+  if (cls < 0) { return p; }
+  q = malloc(mpc_mem_size(cls));
+  memcpy(q, p, mpc_mem_size(cls));
   mpc_free(i, p);
   return q;
 }
@@ -313,14 +615,11 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-
 }
 
+static void mpc_input_ring_drop(mpc_input_t *i);
+
 static void mpc_input_unmark(mpc_input_t *i) {
-  int j;
 
   if (i->backtrack < 1) { return; }
 
@@ -336,11 +635,7 @@ static void mpc_input_unmark(mpc_input_t *i) {
   }
 
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    for (j = strlen(i->buffer) - 1; j >= 0; j--)
-      ungetc(i->buffer[j], i->file);
-
-    free(i->buffer);
-    i->buffer = NULL;
+    mpc_input_ring_drop(i);
   }
 
 }
@@ -352,19 +647,103 @@ static void mpc_input_rewind(mpc_input_t *i) {
   i->state = i->marks[i->marks_num-1];
   i->last  = i->lasts[i->marks_num-1];
 
-  if (i->type == MPC_INPUT_FILE) {
-    fseek(i->file, i->state.pos, SEEK_SET);
+  mpc_input_unmark(i);
+}
+
+/*
+** The ring holds the pipe from `buffer_pos`,
+** the earliest position that may be returned
+** to, up to the furthest character read. Its
+** capacity is a power of two so positions wrap
+** with a mask.
+*/
+static void mpc_input_ring_push(mpc_input_t *i, char c) {
+
+  size_t n, wrap;
+  char *b;
+
+  if (i->buffer_len == i->buffer_cap) {
+    n = i->buffer_cap ? i->buffer_cap * 2 : MPC_INPUT_RING_MIN;
+    b = malloc(n);
+    if (i->buffer) {
+      wrap = i->buffer_cap - i->buffer_head;
+      if (wrap > i->buffer_len) { wrap = i->buffer_len; }
+      memcpy(b, i->buffer + i->buffer_head, wrap);
+      memcpy(b + wrap, i->buffer, i->buffer_len - wrap);
+    }
+    free(i->buffer);
+    i->buffer = b;
+    i->buffer_head = 0;
+    i->buffer_cap = n;
   }
 
-  mpc_input_unmark(i);
+  i->buffer[(i->buffer_head + i->buffer_len) & (i->buffer_cap - 1)] = c;
+  i->buffer_len++;
+}
+
+static void mpc_input_ring_drop(mpc_input_t *i) {
+  size_t n = i->state.pos - i->buffer_pos;
+  if (n == 0) { return; }
+  i->buffer_head = (i->buffer_head + n) & (i->buffer_cap - 1);
+  i->buffer_len -= n;
+  i->buffer_pos = i->state.pos;
+}
+
+/* Reading one past the ring pulls the next character from the pipe */
+static char mpc_input_ring_get(mpc_input_t *i) {
+
+  size_t off = i->state.pos - i->buffer_pos;
+  int c;
+
+  if (off == i->buffer_len) {
+    if (i->buffer_eof) { return '\0'; }
+    c = getc(i->file);
+    if (c == EOF) { i->buffer_eof = 1; return '\0'; }
+    mpc_input_ring_push(i, c);
+  }
+
+  return i->buffer[(i->buffer_head + off) & (i->buffer_cap - 1)];
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
+/*
+** The file is always positioned at the end
+** of the window, so reading on from it needs
+** no seek. A window is refilled from a little
+** before the cursor to leave room to backtrack.
+*/
+static void mpc_input_window_fill(mpc_input_t *i) {
+
+  long pos = i->state.pos;
+  long start = pos > MPC_INPUT_WINDOW_KEEP ? pos - MPC_INPUT_WINDOW_KEEP : 0;
+  long end = i->window_pos + (long)i->window_len;
+  size_t kept = 0;
+
+  if (start >= i->window_pos && start <= end) {
+    kept = end - start;
+    memmove(i->window, i->window + (start - i->window_pos), kept);
+  } else {
+    fseek(i->file, start, SEEK_SET);
+  }
+
+  i->window_pos = start;
+  i->window_len = kept + fread(i->window + kept, 1, MPC_INPUT_WINDOW - kept, i->file);
+  i->window_eof = i->window_len < MPC_INPUT_WINDOW;
 }
 
-static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
+static char mpc_input_window_get(mpc_input_t *i) {
+
+  long pos = i->state.pos;
+  long end = i->window_pos + (long)i->window_len;
+
+  if (pos >= i->window_pos && pos < end) {
+    return i->window[pos - i->window_pos];
+  }
+
+  if (pos == end && i->window_eof) { return '\0'; }
+
+  mpc_input_window_fill(i);
+  end = i->window_pos + (long)i->window_len;
+  return pos < end ? i->window[pos - i->window_pos] : '\0';
 }
 
 static char mpc_input_getc(mpc_input_t *i) {
@@ -374,18 +753,10 @@ static char mpc_input_getc(mpc_input_t *i) {
   switch (i->type) {
 
     case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE: c = fgetc(i->file); return c;
-    case MPC_INPUT_PIPE:
-
-      if (!i->buffer) { c = getc(i->file); return c; }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
+    case MPC_INPUT_MMAP:
+      return (size_t)i->state.pos < i->length ? i->string[i->state.pos] : '\0';
+    case MPC_INPUT_FILE: return mpc_input_window_get(i);
+    case MPC_INPUT_PIPE: return mpc_input_ring_get(i);
 
     default: return c;
   }
@@ -397,31 +768,10 @@ static char mpc_input_peekc(mpc_input_t *i) {
 
   switch (i->type) {
     case MPC_INPUT_STRING: return i->string[i->state.pos];
-    case MPC_INPUT_FILE:
-
-      c = fgetc(i->file);
-      if (feof(i->file)) { return '\0'; }
-
-      fseek(i->file, -1, SEEK_CUR);
-      return c;
-
-    case MPC_INPUT_PIPE:
-
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
+    case MPC_INPUT_MMAP:
+      return (size_t)i->state.pos < i->length ? i->string[i->state.pos] : '\0';
+    case MPC_INPUT_FILE: return mpc_input_window_get(i);
+    case MPC_INPUT_PIPE: return mpc_input_ring_get(i);
 
     default: return c;
   }
@@ -432,39 +782,23 @@ static int mpc_input_terminated(mpc_input_t *i) {
   return mpc_input_peekc(i) == '\0';
 }
 
+/* Characters are only consumed on success so failing has nothing to undo */
 static int mpc_input_failure(mpc_input_t *i, char c) {
-
-  switch (i->type) {
-    case MPC_INPUT_STRING: { break; }
-    case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
-    case MPC_INPUT_PIPE: {
-
-      if (!i->buffer) { ungetc(c, i->file); break; }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file);
-      }
-    }
-    default: { break; }
-  }
+  (void)i;
+  (void)c;
   return 0;
 }
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
 
-  if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
-
   i->last = c;
   i->state.pos++;
   i->state.col++;
 
+  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
+    mpc_input_ring_drop(i);
+  }
+
   if (c == '\n') {
     i->state.col = 0;
     i->state.row++;
@@ -500,18 +834,11 @@ static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
 }
 
-static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
-  char x;
-  if (mpc_input_terminated(i)) { return 0; }
-  x = mpc_input_getc(i);
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
-}
-
-static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
-  char x;
-  if (mpc_input_terminated(i)) { return 0; }
-  x = mpc_input_getc(i);
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+/* The bitmap never has '\0' so the end of input fails without a check */
+static int mpc_input_set(mpc_input_t *i, const unsigned char *bits, char **o) {
+  char x = mpc_input_getc(i);
+  unsigned char c = x;
+  return bits[c / 8] & (1 << (c % 8)) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
@@ -535,8 +862,10 @@ static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   }
   mpc_input_unmark(i);
 
-  *o = mpc_malloc(i, strlen(c) + 1);
-  strcpy(*o, c);
+  if (o) {
+    *o = mpc_malloc(i, strlen(c) + 1);
+    strcpy(*o, c);
+  }
   return 1;
 }
 
@@ -601,14 +930,13 @@ static void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt
   va_end(va);
 }
 
-static char char_unescape_buffer[4];
-
-static const char *mpc_err_char_unescape(char c) {
+/* Writes into the caller's buffer so errors can be printed from any thread */
+static const char *mpc_err_char_unescape(char c, char *buffer) {
 
-  char_unescape_buffer[0] = '\'';
-  char_unescape_buffer[1] = ' ';
-  char_unescape_buffer[2] = '\'';
-  char_unescape_buffer[3] = '\0';
+  buffer[0] = '\'';
+  buffer[1] = ' ';
+  buffer[2] = '\'';
+  buffer[3] = '\0';
 
   switch (c) {
     case '\a': return "bell";
@@ -621,8 +949,8 @@ static const char *mpc_err_char_unescape(char c) {
     case '\t': return "tab";
     case ' ' : return "space";
     default:
-      char_unescape_buffer[1] = c;
-      return char_unescape_buffer;
+      buffer[1] = c;
+      return buffer;
   }
 
 }
@@ -632,6 +960,7 @@ char *mpc_err_string(mpc_err_t *x) {
   int i;
   int pos = 0;
   int max = 1023;
+  char unescaped[4];
   char *buffer = calloc(1, 1024);
 
   if (x->failure) {
@@ -657,7 +986,7 @@ char *mpc_err_string(mpc_err_t *x) {
   }
 
   mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->received));
+  mpc_err_string_cat(buffer, &pos, &max, "%s", mpc_err_char_unescape(x->received, unescaped));
   mpc_err_string_cat(buffer, &pos, &max, "\n");
 
   return realloc(buffer, strlen(buffer) + 1);
@@ -876,6 +1205,32 @@ static mpc_err_t *mpc_err_merge(mpc_input_t *i, mpc_err_t *x, mpc_err_t *y) {
   return mpc_err_or(i, errs, 2);
 }
 
+static mpc_err_t *mpc_err_copy(mpc_input_t *i, mpc_err_t *x) {
+
+  int j;
+  mpc_err_t *y;
+
+  if (x == NULL) { return NULL; }
+
+  y = mpc_malloc(i, sizeof(mpc_err_t));
+  memcpy(y, x, sizeof(mpc_err_t));
+  y->filename = mpc_malloc(i, strlen(x->filename) + 1);
+  strcpy(y->filename, x->filename);
+
+  y->expected = x->expected_num ? mpc_malloc(i, sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) {
+    y->expected[j] = mpc_malloc(i, strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+  }
+
+  if (x->failure) {
+    y->failure = mpc_malloc(i, strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+
+  return y;
+}
+
 /*
 ** Parser Type
 */
@@ -892,29 +1247,31 @@ enum {
 
   MPC_TYPE_ANY        = 8,
   MPC_TYPE_SINGLE     = 9,
-  MPC_TYPE_ONEOF      = 10,
-  MPC_TYPE_NONEOF     = 11,
-  MPC_TYPE_RANGE      = 12,
-  MPC_TYPE_SATISFY    = 13,
-  MPC_TYPE_STRING     = 14,
-
-  MPC_TYPE_APPLY      = 15,
-  MPC_TYPE_APPLY_TO   = 16,
-  MPC_TYPE_PREDICT    = 17,
-  MPC_TYPE_NOT        = 18,
-  MPC_TYPE_MAYBE      = 19,
-  MPC_TYPE_MANY       = 20,
-  MPC_TYPE_MANY1      = 21,
-  MPC_TYPE_COUNT      = 22,
-
-  MPC_TYPE_OR         = 23,
-  MPC_TYPE_AND        = 24,
-
-  MPC_TYPE_CHECK      = 25,
-  MPC_TYPE_CHECK_WITH = 26,
-
-  MPC_TYPE_SOI        = 27,
-  MPC_TYPE_EOI        = 28
+  MPC_TYPE_SET        = 10,
+  MPC_TYPE_RANGE      = 11,
+  MPC_TYPE_SATISFY    = 12,
+  MPC_TYPE_STRING     = 13,
+
+  MPC_TYPE_APPLY      = 14,
+  MPC_TYPE_APPLY_TO   = 15,
+  MPC_TYPE_PREDICT    = 16,
+  MPC_TYPE_NOT        = 17,
+  MPC_TYPE_MAYBE      = 18,
+  MPC_TYPE_MANY       = 19,
+  MPC_TYPE_MANY1      = 20,
+  MPC_TYPE_COUNT      = 21,
+
+  MPC_TYPE_OR         = 22,
+  MPC_TYPE_AND        = 23,
+
+  MPC_TYPE_CHECK      = 24,
+  MPC_TYPE_CHECK_WITH = 25,
+
+  MPC_TYPE_SOI        = 26,
+  MPC_TYPE_EOI        = 27,
+
+  MPC_TYPE_DFA        = 28,
+  MPC_TYPE_PACKRAT    = 29
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -925,16 +1282,46 @@ typedef struct { char x; } mpc_pdata_single_t;
 typedef struct { char x; char y; } mpc_pdata_range_t;
 typedef struct { int(*f)(char); } mpc_pdata_satisfy_t;
 typedef struct { char *x; } mpc_pdata_string_t;
+typedef struct { unsigned char bits[32]; char *x; } mpc_pdata_set_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_check_t f; char *e; } mpc_pdata_check_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_check_with_t f; void *d; char *e; } mpc_pdata_check_with_t;
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
+typedef struct { mpc_parser_t *x; mpc_copy_t cp; mpc_dtor_t dx; } mpc_pdata_packrat_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; unsigned long *viable; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
 
+/*
+** A compiled regex. `next` holds 256 transitions
+** per state, -1 where the match dies. The errors
+** the regex leaves behind depend only on the state
+** it dies in, so they are worked out once when it
+** is compiled: `stop` are merged when a match ends
+** and the `fail` pair when it fails on the first
+** character. Any that could not be worked out are
+** left unknown and the tree `x` is run instead.
+*/
+
+typedef struct {
+  int known;
+  int expected_num;
+  char **expected;
+} mpc_dfa_err_t;
+
+typedef struct {
+  int num;
+  int *next;
+  char *accept;
+  mpc_dfa_err_t *stop;
+  mpc_dfa_err_t fail_merged;
+  mpc_dfa_err_t fail_returned;
+} mpc_dfa_t;
+
+typedef struct { mpc_dfa_t *d; mpc_parser_t *x; } mpc_pdata_dfa_t;
+
 typedef union {
   mpc_pdata_fail_t fail;
   mpc_pdata_lift_t lift;
@@ -944,22 +1331,43 @@ typedef union {
   mpc_pdata_range_t range;
   mpc_pdata_satisfy_t satisfy;
   mpc_pdata_string_t string;
+  mpc_pdata_set_t set;
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_check_t check;
   mpc_pdata_check_with_t check_with;
   mpc_pdata_predict_t predict;
+  mpc_pdata_packrat_t packrat;
   mpc_pdata_not_t not;
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
 } mpc_pdata_t;
 
+/*
+** What the optimiser knows of the start of a
+** parser: `first` holds the characters it may
+** consume first, and `lead` whether it may also
+** succeed without consuming any.
+*/
+
+enum {
+  MPC_LEAD_UNKNOWN  = 0,
+  MPC_LEAD_CONSUMES = 1,
+  MPC_LEAD_NULLABLE = 2
+};
+
 struct mpc_parser_t {
   char *name;
   mpc_pdata_t data;
   char type;
   char retained;
+  char span;
+  char lead;
+  unsigned char first[32];
+  /* Rule id mpca_lang gives the nodes this parser builds */
+  int id;
 };
 
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
@@ -974,11 +1382,17 @@ static mpc_val_t *mpcf_input_trd_free(mpc_input_t *i, int n, mpc_val_t **xs) { r
 
 static mpc_val_t *mpcf_input_strfold(mpc_input_t *i, int n, mpc_val_t **xs) {
   int j;
-  size_t l = 0;
+  size_t l = 0, m;
   if (n == 0) { return mpc_calloc(i, 1, 1); }
   for (j = 0; j < n; j++) { l += strlen(xs[j]); }
+  m = strlen(xs[0]);
   xs[0] = mpc_realloc(i, xs[0], l + 1);
-  for (j = 1; j < n; j++) { strcat(xs[0], xs[j]); mpc_free(i, xs[j]); }
+  for (j = 1; j < n; j++) {
+    l = strlen(xs[j]);
+    memcpy((char*)xs[0] + m, xs[j], l + 1);
+    m += l;
+    mpc_free(i, xs[j]);
+  }
   return xs[0];
 }
 
@@ -1027,50 +1441,425 @@ static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t
   return f(mpc_export(i, x), d);
 }
 
-static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
-  if (d == free) { mpc_free(i, x); return; }
-  d(mpc_export(i, x));
+static void mpc_dfa_err_delete(mpc_dfa_err_t *x) {
+  int j;
+  for (j = 0; j < x->expected_num; j++) { free(x->expected[j]); }
+  free(x->expected);
 }
 
-enum {
-  MPC_PARSE_STACK_MIN = 4
-};
+static void mpc_dfa_err_copy(mpc_dfa_err_t *x, const mpc_dfa_err_t *y) {
+  int j;
+  *x = *y;
+  if (y->expected_num <= 0) { x->expected = NULL; return; }
+  x->expected = malloc(sizeof(char*) * y->expected_num);
+  for (j = 0; j < y->expected_num; j++) {
+    x->expected[j] = malloc(strlen(y->expected[j]) + 1);
+    strcpy(x->expected[j], y->expected[j]);
+  }
+}
 
-#define MPC_SUCCESS(x) r->output = x; return 1
-#define MPC_FAILURE(x) r->error = x; return 0
-#define MPC_PRIMITIVE(x) \
-  if (x) { MPC_SUCCESS(r->output); } \
-  else { MPC_FAILURE(NULL); }
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  int j;
+  for (j = 0; j < d->num; j++) { mpc_dfa_err_delete(&d->stop[j]); }
+  mpc_dfa_err_delete(&d->fail_merged);
+  mpc_dfa_err_delete(&d->fail_returned);
+  free(d->stop);
+  free(d->accept);
+  free(d->next);
+  free(d);
+}
 
-#define MPC_MAX_RECURSION_DEPTH 1000
+static mpc_dfa_t *mpc_dfa_copy(const mpc_dfa_t *a) {
+  int j;
+  mpc_dfa_t *d = malloc(sizeof(mpc_dfa_t));
+  d->num = a->num;
+  d->next = malloc(sizeof(int) * 256 * a->num);
+  memcpy(d->next, a->next, sizeof(int) * 256 * a->num);
+  d->accept = malloc(a->num);
+  memcpy(d->accept, a->accept, a->num);
+  d->stop = malloc(sizeof(mpc_dfa_err_t) * a->num);
+  for (j = 0; j < a->num; j++) { mpc_dfa_err_copy(&d->stop[j], &a->stop[j]); }
+  mpc_dfa_err_copy(&d->fail_merged, &a->fail_merged);
+  mpc_dfa_err_copy(&d->fail_returned, &a->fail_returned);
+  return d;
+}
+
+static mpc_err_t *mpc_dfa_err_new(mpc_input_t *i, const mpc_dfa_err_t *x, mpc_state_t s, char received) {
+  int j;
+  mpc_err_t *y;
+  if (x->expected_num < 0) { return NULL; }
+  y = mpc_malloc(i, sizeof(mpc_err_t));
+  y->filename = mpc_malloc(i, strlen(i->filename) + 1);
+  strcpy(y->filename, i->filename);
+  y->state = s;
+  y->expected_num = x->expected_num;
+  y->expected = x->expected_num ? mpc_malloc(i, sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) {
+    y->expected[j] = mpc_malloc(i, strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+  }
+  y->failure = NULL;
+  y->received = received;
+  return y;
+}
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+/*
+** Runs a compiled regex from the cursor, taking the
+** longest match. Returns -1 without consuming input
+** when the errors it would leave are not known, so
+** that the caller can run the combinators instead.
+** The match is only copied out if `o` is given.
+*/
+static int mpc_input_dfa(mpc_input_t *i, const mpc_dfa_t *d, mpc_err_t **r, mpc_err_t **e, char **o) {
 
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
-  int results_slots = MPC_PARSE_STACK_MIN;
+  mpc_state_t start = i->state, acc = i->state;
+  char last = i->last, c;
+  int q = 0, n, matched = d->accept[0];
+  long j, len;
 
-  if (depth == MPC_MAX_RECURSION_DEPTH)
-  {
-    MPC_FAILURE(mpc_err_fail(i, "Maximum recursion depth exceeded!"));
+  mpc_input_mark(i);
+
+  while (1) {
+    c = mpc_input_getc(i);
+    n = d->next[q * 256 + (unsigned char)c];
+    if (n < 0) { break; }
+    q = n;
+    i->state.pos++;
+    i->state.col++;
+    if (c == '\n') {
+      i->state.col = 0;
+      i->state.row++;
+    }
+    if (d->accept[q]) {
+      acc = i->state;
+      last = c;
+      matched = 1;
+    }
   }
 
-  switch (p->type) {
+  if (!matched) {
+    n = i->state.pos == start.pos;
+    mpc_input_rewind(i);
+    *r = NULL;
+    if (i->suppress) { return 0; }
+    if (!n || !d->fail_merged.known || !d->fail_returned.known) { return -1; }
+    *e = mpc_err_merge(i, *e, mpc_dfa_err_new(i, &d->fail_merged, start, c));
+    *r = mpc_dfa_err_new(i, &d->fail_returned, start, c);
+    return 0;
+  }
+
+  if (!i->suppress) {
+    if (!d->stop[q].known) {
+      mpc_input_rewind(i);
+      return -1;
+    }
+    *e = mpc_err_merge(i, *e, mpc_dfa_err_new(i, &d->stop[q], i->state, c));
+  }
+
+  if (o) {
+    len = acc.pos - start.pos;
+    *o = mpc_malloc(i, len + 1);
+    if (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP) {
+      memcpy(*o, i->string + start.pos, len);
+    } else {
+      i->state = start;
+      for (j = 0; j < len; j++) {
+        (*o)[j] = mpc_input_getc(i);
+        i->state.pos++;
+      }
+    }
+    (*o)[len] = '\0';
+  }
+
+  i->state = acc;
+  i->last = last;
+  mpc_input_unmark(i);
+
+  return 1;
+}
+
+static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
+  if (d == free) { mpc_free(i, x); return; }
+  d(mpc_export(i, x));
+}
+
+enum {
+  MPC_PARSE_STACK_MIN = 4
+};
+
+#define MPC_SUCCESS(x) r->output = x; return 1
+#define MPC_FAILURE(x) r->error = x; return 0
+#define MPC_PRIMITIVE(x) \
+  if (x) { MPC_SUCCESS(r->output); } \
+  else { MPC_FAILURE(NULL); }
+
+#define MPC_MAX_RECURSION_DEPTH 1000
+
+/*
+** Runs a parser flagged `span` by the optimiser,
+** whose output is always just the text it consumed.
+** No output is built on the way, the caller copies
+** the text out of the input once at the end. Errors
+** come out exactly as from `mpc_parse_run`.
+*/
+static int mpc_parse_span(mpc_input_t *i, const mpc_parser_t *p, mpc_err_t **r, mpc_err_t **e, int depth) {
+
+  int j = 0, k;
+  mpc_err_t *x = NULL;
+
+  *r = NULL;
+
+  if (depth == MPC_MAX_RECURSION_DEPTH) {
+    *r = mpc_err_fail(i, "Maximum recursion depth exceeded!");
+    return 0;
+  }
+
+  switch (p->type) {
+
+    case MPC_TYPE_ANY:     return mpc_input_any(i, NULL);
+    case MPC_TYPE_SINGLE:  return mpc_input_char(i, p->data.single.x, NULL);
+    case MPC_TYPE_RANGE:   return mpc_input_range(i, p->data.range.x, p->data.range.y, NULL);
+    case MPC_TYPE_SET:     return mpc_input_set(i, p->data.set.bits, NULL);
+    case MPC_TYPE_SATISFY: return mpc_input_satisfy(i, p->data.satisfy.f, NULL);
+    case MPC_TYPE_STRING:  return mpc_input_string(i, p->data.string.x, NULL);
+    case MPC_TYPE_LIFT:    return 1;
+
+    case MPC_TYPE_DFA:
+      k = i->backtrack > 0 ? mpc_input_dfa(i, p->data.dfa.d, r, e, NULL) : -1;
+      if (k >= 0) { return k; }
+      return mpc_parse_span(i, p->data.dfa.x, r, e, depth+1);
+
+    case MPC_TYPE_EXPECT:
+      mpc_input_suppress_enable(i);
+      k = mpc_parse_span(i, p->data.expect.x, &x, e, depth+1);
+      mpc_input_suppress_disable(i);
+      if (!k) { *r = mpc_err_new(i, p->data.expect.m); }
+      return k;
+
+    case MPC_TYPE_MAYBE:
+      if (!mpc_parse_span(i, p->data.not.x, &x, e, depth+1)) {
+        *e = mpc_err_merge(i, *e, x);
+      }
+      return 1;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      while (mpc_parse_span(i, p->data.repeat.x, &x, e, depth+1)) { j++; }
+      if (j == 0 && p->type == MPC_TYPE_MANY1) {
+        *r = mpc_err_many1(i, x);
+        return 0;
+      }
+      *e = mpc_err_merge(i, *e, x);
+      return 1;
+
+    case MPC_TYPE_COUNT:
+      while (mpc_parse_span(i, p->data.repeat.x, &x, e, depth+1)) {
+        j++;
+        if (j == p->data.repeat.n) { return 1; }
+      }
+      if (j == p->data.repeat.n) {
+        mpc_err_delete_internal(i, x);
+        return 1;
+      }
+      *r = mpc_err_count(i, x, p->data.repeat.n);
+      return 0;
+
+    case MPC_TYPE_OR:
+      for (j = 0; j < p->data.or.n; j++) {
+        if (mpc_parse_span(i, p->data.or.xs[j], &x, e, depth+1)) { return 1; }
+        *e = mpc_err_merge(i, *e, x);
+      }
+      return 0;
+
+    case MPC_TYPE_AND:
+      mpc_input_mark(i);
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_parse_span(i, p->data.and.xs[j], r, e, depth+1)) {
+          mpc_input_rewind(i);
+          return 0;
+        }
+      }
+      mpc_input_unmark(i);
+      return 1;
+
+    default: return 0;
+  }
+
+}
+
+/*
+** Packrat Parsing
+**
+** A memoised result holds where the parser left
+** the input, a copy of its output or error, and
+** a copy of the errors it merged into the caller
+** on the way. These last are gathered apart and
+** merged in one go, which comes out the same as
+** merging them one by one. Whether errors were
+** suppressed or backtracking disabled changes
+** what a parser does, so they are part of the key.
+**
+** Only inputs held whole in memory are memoised,
+** as the cursor must be able to jump forward.
+**
+** Outputs are copied with `cp` both when stored
+** and when handed back, so a hit costs time in
+** the size of the output rather than nothing.
+*/
+
+static size_t mpc_memo_slot(const mpc_parser_t *p, long pos) {
+  return (((size_t)pos * 2654435761u) ^ ((size_t)p >> 4)) & (MPC_MEMO_SLOTS - 1);
+}
+
+static void mpc_memo_evict(mpc_input_t *i, mpc_memo_t *m) {
+  if (m->p == NULL) { return; }
+  if (m->ok && m->x) { mpc_parse_dtor(i, m->p->data.packrat.dx, m->x); }
+  if (!m->ok) { mpc_err_delete_internal(i, m->x); }
+  mpc_err_delete_internal(i, m->e);
+  m->p = NULL;
+}
+
+static void mpc_memo_clear(mpc_input_t *i) {
+  int j;
+  if (i->memo == NULL) { return; }
+  for (j = 0; j < MPC_MEMO_SLOTS; j++) { mpc_memo_evict(i, &i->memo[j]); }
+}
+
+static int mpc_parse_run(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth);
+
+static int mpc_parse_packrat(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+
+  const mpc_pdata_packrat_t *d = &p->data.packrat;
+  mpc_memo_t *m;
+  mpc_err_t *x = NULL;
+  long pos = i->state.pos;
+  char flags = (i->suppress ? 1 : 0) | (i->backtrack > 0 ? 2 : 0);
+  int k;
+
+  if (i->memo == NULL) { i->memo = calloc(MPC_MEMO_SLOTS, sizeof(mpc_memo_t)); }
+  m = &i->memo[mpc_memo_slot(p, pos)];
+
+  if (m->p == p && m->pos == pos && m->flags == flags) {
+    i->state = m->end;
+    i->last = m->last;
+    if (m->e) { *e = mpc_err_merge(i, *e, mpc_err_copy(i, m->e)); }
+    if (m->ok) { r->output = m->x ? d->cp(m->x) : NULL; }
+    else { r->error = mpc_err_copy(i, m->x); }
+    return m->ok;
+  }
+
+  k = mpc_parse_run(i, d->x, r, &x, depth+1);
+
+  mpc_memo_evict(i, m);
+  m->p = p;
+  m->pos = pos;
+  m->flags = flags;
+  m->ok = k;
+  m->end = i->state;
+  m->last = i->last;
+  if (k) { m->x = r->output ? d->cp(r->output) : NULL; }
+  else { m->x = mpc_err_copy(i, r->error); }
+  m->e = mpc_err_copy(i, x);
+
+  if (x) { *e = mpc_err_merge(i, *e, x); }
+  return k;
+}
+
+/*
+** Tries only the alternatives of an `or` that may
+** start with the next character. The others would
+** fail there without consuming anything, so their
+** errors all lie at this position. They can be left
+** out as long as something further on is reported:
+** an alternative that succeeds has consumed input,
+** so anything failing after it lies beyond, and the
+** same goes for one that fails having moved the
+** input, or one whose errors are suppressed anyway.
+** Otherwise `-1` is returned with the input
+** untouched, and the caller tries every alternative
+** in order as before.
+*/
+static int mpc_parse_or_viable(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+
+  int j;
+  long pos = i->state.pos;
+  unsigned long m = p->data.or.viable[(unsigned char)mpc_input_peekc(i)];
+  mpc_err_t *x = NULL;
+
+  if (m == 0) { return -1; }
+
+  for (j = 0; j < p->data.or.n; j++) {
+    if (!(m & (1UL << j))) { continue; }
+    if (mpc_parse_run(i, p->data.or.xs[j], r, &x, depth+1)) {
+      if (x) { *e = mpc_err_merge(i, *e, x); }
+      return 1;
+    }
+    x = mpc_err_merge(i, x, r->error);
+    if (i->state.pos != pos) { break; }
+  }
+
+  if (i->state.pos == pos && !i->suppress && (x == NULL || x->state.pos == pos)) {
+    mpc_err_delete_internal(i, x);
+    return -1;
+  }
+
+  for (j++; j < p->data.or.n; j++) {
+    if (mpc_parse_run(i, p->data.or.xs[j], r, &x, depth+1)) {
+      *e = mpc_err_merge(i, *e, x);
+      return 1;
+    }
+    x = mpc_err_merge(i, x, r->error);
+  }
+
+  *e = mpc_err_merge(i, *e, x);
+  r->error = NULL;
+  return 0;
+}
+
+static int mpc_parse_run(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+
+  int j = 0, k = 0;
+  long start;
+  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
+  mpc_result_t *results;
+  int results_slots = MPC_PARSE_STACK_MIN;
+
+  if (depth == MPC_MAX_RECURSION_DEPTH)
+  {
+    MPC_FAILURE(mpc_err_fail(i, "Maximum recursion depth exceeded!"));
+  }
+
+  /* Text kept whole in memory can be copied out once the span is known */
+  if (p->span && (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP)) {
+    start = i->state.pos;
+    if (!mpc_parse_span(i, p, &r->error, e, depth)) { return 0; }
+    r->output = mpc_malloc(i, i->state.pos - start + 1);
+    memcpy(r->output, i->string + start, i->state.pos - start);
+    ((char*)r->output)[i->state.pos - start] = '\0';
+    return 1;
+  }
+
+  switch (p->type) {
 
     /* Basic Parsers */
 
     case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
     case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
     case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
+    case MPC_TYPE_SET:     MPC_PRIMITIVE(mpc_input_set(i, p->data.set.bits, (char**)&r->output));
     case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
     case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
     case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
     case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
     case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
 
+    /* Compiled Regex */
+
+    case MPC_TYPE_DFA:
+      k = i->backtrack > 0 ? mpc_input_dfa(i, p->data.dfa.d, &r->error, e, (char**)&r->output) : -1;
+      if (k >= 0) { return k; }
+      return mpc_parse_run(i, p->data.dfa.x, r, e, depth+1);
+
     /* Other parsers */
 
     case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
@@ -1130,6 +1919,12 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
       }
 
+    case MPC_TYPE_PACKRAT:
+      if (i->type == MPC_INPUT_STRING || i->type == MPC_INPUT_MMAP) {
+        return mpc_parse_packrat(i, p, r, e, depth);
+      }
+      return mpc_parse_run(i, p->data.packrat.x, r, e, depth+1);
+
     case MPC_TYPE_PREDICT:
       mpc_input_backtrack_disable(i);
       if (mpc_parse_run(i, p->data.predict.x, r, e, depth+1)) {
@@ -1249,6 +2044,11 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
 
       if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
 
+      if (p->data.or.viable) {
+        k = mpc_parse_or_viable(i, p, r, e, depth);
+        if (k >= 0) { return k; }
+      }
+
       results = p->data.or.n > MPC_PARSE_STACK_MIN
         ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
         : results_stk;
@@ -1304,11 +2104,12 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
 #undef MPC_FAILURE
 #undef MPC_PRIMITIVE
 
-int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
+int mpc_parse_input(mpc_input_t *i, const mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
   e->state = mpc_state_invalid();
   x = mpc_parse_run(i, p, r, &e, 0);
+  mpc_memo_clear(i);
   if (x) {
     mpc_err_delete_internal(i, e);
     r->output = mpc_export(i, r->output);
@@ -1326,6 +2127,15 @@ int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_res
   return x;
 }
 
+int mpc_parse_pool(const char *filename, const char *string, size_t pool, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  mpc_mem_init(i, pool);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
+
 int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
   int x;
   mpc_input_t *i = mpc_input_new_nstring(filename, string, length);
@@ -1353,6 +2163,7 @@ int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
 
   FILE *f = fopen(filename, "rb");
+  mpc_input_t *i;
   int res;
 
   if (f == NULL) {
@@ -1361,11 +2172,287 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
     return 0;
   }
 
-  res = mpc_parse_file(filename, f, p, r);
+  i = mpc_input_new_contents(filename, f);
+  res = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
   fclose(f);
   return res;
 }
 
+/*
+** Contexts
+**
+** A context keeps one input alive across
+** parses so its mark stack, memory pool and
+** read buffers are allocated once. Between
+** parses only the cursor and pool are reset.
+*/
+
+struct mpc_context_t {
+  mpc_input_t *input;
+  size_t filename_slots;
+  char *string;
+  size_t string_slots;
+};
+
+mpc_context_t *mpc_context_new(size_t pool) {
+
+  mpc_context_t *c = malloc(sizeof(mpc_context_t));
+  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+
+  i->filename = NULL;
+  i->type = MPC_INPUT_STRING;
+  i->state = mpc_state_new();
+
+  i->string = NULL;
+  i->buffer = NULL;
+  i->file = NULL;
+  i->window = NULL;
+  i->buffer_cap = 0;
+
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->last = '\0';
+  i->memo = NULL;
+
+  mpc_mem_init(i, pool);
+
+  c->input = i;
+  c->filename_slots = 0;
+  c->string = NULL;
+  c->string_slots = 0;
+  return c;
+}
+
+void mpc_context_delete(mpc_context_t *c) {
+
+  mpc_input_t *i = c->input;
+
+  free(i->filename);
+  free(i->buffer);
+  free(i->window);
+
+  mpc_mem_delete(i);
+  free(i->marks);
+  free(i->lasts);
+  free(i->memo);
+  free(i);
+
+  free(c->string);
+  free(c);
+}
+
+static mpc_input_t *mpc_context_open(mpc_context_t *c, const char *filename, int type) {
+
+  mpc_input_t *i = c->input;
+  size_t n = strlen(filename) + 1;
+
+  if (n > c->filename_slots) {
+    c->filename_slots = n;
+    i->filename = realloc(i->filename, n);
+  }
+  memcpy(i->filename, filename, n);
+
+  i->type = type;
+  i->state = mpc_state_new();
+  i->file = NULL;
+
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->marks_num = 0;
+  i->last = '\0';
+
+  mpc_mem_reset(i);
+
+  return i;
+}
+
+/* The string is only read, so unlike mpc_parse it is not copied */
+int mpc_parse_ctx(mpc_context_t *c, const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+  mpc_input_t *i = mpc_context_open(c, filename, MPC_INPUT_STRING);
+  i->string = (char*)string;
+  return mpc_parse_input(i, p, r);
+}
+
+int mpc_nparse_ctx(mpc_context_t *c, const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
+
+  mpc_input_t *i = mpc_context_open(c, filename, MPC_INPUT_STRING);
+
+  if (length + 1 > c->string_slots) {
+    c->string_slots = length + 1;
+    c->string = realloc(c->string, c->string_slots);
+  }
+
+  strncpy(c->string, string, length);
+  c->string[length] = '\0';
+
+  i->string = c->string;
+  return mpc_parse_input(i, p, r);
+}
+
+int mpc_parse_file_ctx(mpc_context_t *c, const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
+
+  mpc_input_t *i = mpc_context_open(c, filename, MPC_INPUT_FILE);
+
+  if (i->window == NULL) { i->window = malloc(MPC_INPUT_WINDOW); }
+  i->file = file;
+  i->window_pos = 0;
+  i->window_len = 0;
+  i->window_eof = 0;
+
+  return mpc_parse_input(i, p, r);
+}
+
+int mpc_parse_pipe_ctx(mpc_context_t *c, const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r) {
+
+  mpc_input_t *i = mpc_context_open(c, filename, MPC_INPUT_PIPE);
+
+  i->file = pipe;
+  i->buffer_pos = 0;
+  i->buffer_head = 0;
+  i->buffer_len = 0;
+  i->buffer_eof = 0;
+
+  return mpc_parse_input(i, p, r);
+}
+
+int mpc_parse_contents_ctx(mpc_context_t *c, const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+
+  FILE *f = fopen(filename, "rb");
+  int res;
+#ifdef MPC_MMAP
+  mpc_input_t *i;
+  size_t length;
+  char *m;
+#endif
+
+  if (f == NULL) {
+    r->output = NULL;
+    r->error = mpc_err_file(filename, "Unable to open file!");
+    return 0;
+  }
+
+#ifdef MPC_MMAP
+  m = mpc_input_map(f, &length);
+  if (m) {
+    i = mpc_context_open(c, filename, MPC_INPUT_MMAP);
+    i->string = m;
+    i->length = length;
+    res = mpc_parse_input(i, p, r);
+    munmap(m, length);
+    fclose(f);
+    return res;
+  }
+#endif
+
+  res = mpc_parse_file_ctx(c, filename, f, p, r);
+  fclose(f);
+  return res;
+}
+
+/*
+** Parallel Parsing
+**
+** Parsing never writes to the parser graph and
+** keeps all of its state in the input, so once
+** built a grammar can be shared by any number
+** of threads. A grammar must not be defined,
+** changed or deleted while it is in use, and
+** any apply or fold functions it calls must be
+** safe to run concurrently. Parsers made with
+** mpc_lift_val hand every thread the same value.
+**
+** Each thread of a batch parses through its own
+** context, taking the next unclaimed input from
+** a shared counter. The calling thread works
+** too, and without threads the whole batch is
+** parsed on it in order.
+*/
+
+typedef struct {
+  const char *filename;
+  const char **strings;
+  const mpc_parser_t *parser;
+  mpc_result_t *results;
+  int *oks;
+  int num;
+  int next;
+#ifdef MPC_THREADS
+  pthread_mutex_t lock;
+#endif
+} mpc_batch_t;
+
+static int mpc_batch_next(mpc_batch_t *b) {
+  int j;
+#ifdef MPC_THREADS
+  pthread_mutex_lock(&b->lock);
+#endif
+  j = b->next < b->num ? b->next++ : -1;
+#ifdef MPC_THREADS
+  pthread_mutex_unlock(&b->lock);
+#endif
+  return j;
+}
+
+static void *mpc_batch_run(void *x) {
+
+  mpc_batch_t *b = x;
+  mpc_context_t *c = mpc_context_new(0);
+  mpc_input_t *i;
+  int j;
+
+  while ((j = mpc_batch_next(b)) >= 0) {
+    i = mpc_context_open(c, b->filename, MPC_INPUT_STRING);
+    i->string = (char*)b->strings[j];
+    b->oks[j] = mpc_parse_input(i, b->parser, &b->results[j]);
+  }
+
+  mpc_context_delete(c);
+  return NULL;
+}
+
+int mpc_parse_batch(const char *filename, const char **strings, int n, int threads, mpc_parser_t *p, mpc_result_t *r, int *ok) {
+
+  mpc_batch_t b;
+  int j, count = 0;
+#ifdef MPC_THREADS
+  pthread_t *workers;
+  int started = 0;
+#endif
+
+  b.filename = filename;
+  b.strings = strings;
+  b.parser = p;
+  b.results = r;
+  b.oks = ok;
+  b.num = n;
+  b.next = 0;
+
+#ifdef MPC_THREADS
+  pthread_mutex_init(&b.lock, NULL);
+  if (threads > n) { threads = n; }
+  workers = threads > 1 ? malloc(sizeof(pthread_t) * (threads - 1)) : NULL;
+  while (started < threads - 1
+  &&     pthread_create(&workers[started], NULL, mpc_batch_run, &b) == 0) {
+    started++;
+  }
+  mpc_batch_run(&b);
+  for (j = 0; j < started; j++) { pthread_join(workers[j], NULL); }
+  free(workers);
+  pthread_mutex_destroy(&b.lock);
+#else
+  (void)threads;
+  mpc_batch_run(&b);
+#endif
+
+  for (j = 0; j < n; j++) { count += ok[j]; }
+  return count;
+}
+
 /*
 ** Building a Parser
 */
@@ -1379,6 +2466,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  free(p->data.or.viable);
 
 }
 
@@ -1401,8 +2489,8 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
 
     case MPC_TYPE_FAIL: free(p->data.fail.m); break;
 
-    case MPC_TYPE_ONEOF:
-    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SET: free(p->data.set.x); break;
+
     case MPC_TYPE_STRING:
       free(p->data.string.x);
       break;
@@ -1410,6 +2498,7 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
     case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
     case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+    case MPC_TYPE_PACKRAT:  mpc_undefine_unretained(p->data.packrat.x, 0);  break;
 
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1440,6 +2529,11 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
       free(p->data.check_with.e);
       break;
 
+    case MPC_TYPE_DFA:
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      mpc_dfa_delete(p->data.dfa.d);
+      break;
+
     default: break;
   }
 
@@ -1495,6 +2589,9 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
   p->retained = a->retained;
   p->type = a->type;
   p->data = a->data;
+  p->span = a->span;
+  p->lead = a->lead;
+  memcpy(p->first, a->first, 32);
 
   if (a->name) {
     p->name = malloc(strlen(a->name)+1);
@@ -1508,8 +2605,11 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       strcpy(p->data.fail.m, a->data.fail.m);
     break;
 
-    case MPC_TYPE_ONEOF:
-    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SET:
+      p->data.set.x = malloc(strlen(a->data.set.x)+1);
+      strcpy(p->data.set.x, a->data.set.x);
+      break;
+
     case MPC_TYPE_STRING:
       p->data.string.x = malloc(strlen(a->data.string.x)+1);
       strcpy(p->data.string.x, a->data.string.x);
@@ -1518,6 +2618,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
     case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
     case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
     case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    case MPC_TYPE_PACKRAT:  p->data.packrat.x  = mpc_copy(a->data.packrat.x);  break;
 
     case MPC_TYPE_MAYBE:
     case MPC_TYPE_NOT:
@@ -1541,6 +2642,10 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       for (i = 0; i < a->data.or.n; i++) {
         p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
       }
+      if (a->data.or.viable) {
+        p->data.or.viable = malloc(256 * sizeof(unsigned long));
+        memcpy(p->data.or.viable, a->data.or.viable, 256 * sizeof(unsigned long));
+      }
     break;
     case MPC_TYPE_AND:
       p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
@@ -1564,6 +2669,11 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
       strcpy(p->data.check_with.e, a->data.check_with.e);
       break;
 
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      p->data.dfa.d = mpc_dfa_copy(a->data.dfa.d);
+      break;
+
     default: break;
   }
 
@@ -1574,6 +2684,8 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a) {
 mpc_parser_t *mpc_undefine(mpc_parser_t *p) {
   mpc_undefine_unretained(p, 1);
   p->type = MPC_TYPE_UNDEFINED;
+  p->span = 0;
+  p->lead = MPC_LEAD_UNKNOWN;
   return p;
 }
 
@@ -1582,6 +2694,9 @@ mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
   if (p->retained) {
     p->type = a->type;
     p->data = a->data;
+    p->span = a->span;
+    p->lead = a->lead;
+    memcpy(p->first, a->first, 32);
   } else {
     mpc_parser_t *a2 = mpc_failf("Attempt to assign to Unretained Parser!");
     p->type = a2->type;
@@ -1759,21 +2874,44 @@ mpc_parser_t *mpc_range(char s, char e) {
   return mpc_expectf(p, "character between '%c' and '%c'", s, e);
 }
 
-mpc_parser_t *mpc_oneof(const char *s) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_ONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "one of '%s'", s);
+/*
+** A set of characters is kept as a bitmap so
+** testing one is a single lookup. `x` is the
+** set as written between brackets, with a `^`
+** in front when it is negated, for printing.
+*/
+static void mpc_set_add(unsigned char *bits, char c) {
+  bits[(unsigned char)c / 8] |= 1 << ((unsigned char)c % 8);
 }
 
-mpc_parser_t *mpc_noneof(const char *s) {
+static mpc_parser_t *mpc_set(const unsigned char *bits, const char *s, int negate) {
+  int j;
   mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_NONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "none of '%s'", s);
+  p->type = MPC_TYPE_SET;
+  for (j = 0; j < 32; j++) {
+    p->data.set.bits[j] = negate ? ~bits[j] : bits[j];
+  }
+  p->data.set.bits[0] &= ~1;
+  p->data.set.x = malloc(strlen(s) + 2);
+  strcpy(p->data.set.x, negate ? "^" : "");
+  strcat(p->data.set.x, s);
+  return p;
+}
+
+mpc_parser_t *mpc_oneof(const char *s) {
+  unsigned char bits[32];
+  const char *c;
+  memset(bits, 0, 32);
+  for (c = s; *c; c++) { mpc_set_add(bits, *c); }
+  return mpc_expectf(mpc_set(bits, s, 0), "one of '%s'", s);
+}
 
+mpc_parser_t *mpc_noneof(const char *s) {
+  unsigned char bits[32];
+  const char *c;
+  memset(bits, 0, 32);
+  for (c = s; *c; c++) { mpc_set_add(bits, *c); }
+  return mpc_expectf(mpc_set(bits, s, 1), "none of '%s'", s);
 }
 
 mpc_parser_t *mpc_satisfy(int(*f)(char)) {
@@ -1874,6 +3012,24 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+/*
+** Remembers what `a` did at each position, so
+** when backtracking runs it from the same place
+** again the result is handed back rather than
+** parsed afresh. Outputs handed back are made
+** by `cp`, which must not take over its input,
+** and those kept are deleted with `da`. Anything
+** `a` calls must give the same result every time.
+*/
+mpc_parser_t *mpc_packrat(mpc_parser_t *a, mpc_copy_t cp, mpc_dtor_t da) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PACKRAT;
+  p->data.packrat.x = a;
+  p->data.packrat.cp = cp;
+  p->data.packrat.dx = da;
+  return p;
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -1935,6 +3091,7 @@ mpc_parser_t *mpc_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.viable = NULL;
 
   va_start(va, n);
   for (i = 0; i < n; i++) {
@@ -2216,138 +3373,596 @@ static mpc_parser_t *mpc_re_escape_char(char c) {
   }
 }
 
-static mpc_val_t *mpcf_re_escape(mpc_val_t *x, void* data) {
+static mpc_val_t *mpcf_re_escape(mpc_val_t *x, void* data) {
+
+  int mode = *((int*)data);
+  char *s = x;
+  mpc_parser_t *p;
+
+  /* Any Character */
+  if (s[0] == '.') {
+    free(s);
+    if (mode & MPC_RE_DOTALL) {
+      return mpc_any();
+    } else {
+      return mpc_expect(mpc_noneof("\n"), "any character except a newline");
+    }
+  }
+
+  /* Start of Input */
+  if (s[0] == '^') {
+    free(s);
+    if (mode & MPC_RE_MULTILINE) {
+      return mpc_and(2, mpcf_snd, mpc_or(2, mpc_soi(), mpc_boundary_newline()), mpc_lift(mpcf_ctor_str), free);
+    } else {
+      return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
+    }
+  }
+
+  /* End of Input */
+  if (s[0] == '$') {
+    free(s);
+    if (mode & MPC_RE_MULTILINE) {
+      return mpc_or(2,
+        mpc_newline(),
+        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
+    } else {
+      return mpc_or(2,
+        mpc_and(2, mpcf_fst, mpc_newline(), mpc_eoi(), free),
+        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
+    }
+  }
+
+  /* Regex Escape */
+  if (s[0] == '\\') {
+    p = mpc_re_escape_char(s[1]);
+    p = (p == NULL) ? mpc_char(s[1]) : p;
+    free(s);
+    return p;
+  }
+
+  /* Regex Standard */
+  p = mpc_char(s[0]);
+  free(s);
+  return p;
+}
+
+static const char *mpc_re_range_escape_char(char c) {
+  switch (c) {
+    case '-': return "-";
+    case 'a': return "\a";
+    case 'f': return "\f";
+    case 'n': return "\n";
+    case 'r': return "\r";
+    case 't': return "\t";
+    case 'v': return "\v";
+    case 'b': return "\b";
+    case 'd': return "0123456789";
+    case 's': return " \f\n\r\t\v";
+    case 'w': return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    default: return NULL;
+  }
+}
+
+/* Adds to both the set and its text, which is kept for error messages */
+static void mpc_re_range_add(unsigned char *bits, char **range, size_t *len, size_t *max, char c) {
+  if (*len + 1 == *max) {
+    *max *= 2;
+    *range = realloc(*range, *max);
+  }
+  (*range)[(*len)++] = c;
+  (*range)[*len] = '\0';
+  mpc_set_add(bits, c);
+}
+
+static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+
+  mpc_parser_t *out;
+  size_t i, n, len = 0, max = 16;
+  int j;
+  const char *tmp = NULL;
+  const char *s = x;
+  int comp = s[0] == '^' ? 1 : 0;
+  char *range = malloc(max);
+  unsigned char bits[32];
+
+  range[0] = '\0';
+  memset(bits, 0, 32);
+
+  if (s[0] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  if (s[0] == '^' &&
+      s[1] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
+
+  n = strlen(s);
+
+  for (i = comp; i < n; i++){
+
+    /* Regex Range Escape */
+    if (s[i] == '\\') {
+      tmp = mpc_re_range_escape_char(s[i+1]);
+      if (tmp != NULL) {
+        while (*tmp) { mpc_re_range_add(bits, &range, &len, &max, *tmp++); }
+      } else if (s[i+1] != '\0') {
+        mpc_re_range_add(bits, &range, &len, &max, s[i+1]);
+      }
+      i++;
+    }
+
+    /* Regex Range...Range */
+    else if (s[i] == '-') {
+      if (s[i+1] == '\0' || i == 0) {
+        mpc_re_range_add(bits, &range, &len, &max, '-');
+      } else {
+        for (j = s[i-1]+1; j <= s[i+1]-1; j++) {
+          mpc_re_range_add(bits, &range, &len, &max, (char)j);
+        }
+      }
+    }
+
+    /* Regex Range Normal */
+    else {
+      mpc_re_range_add(bits, &range, &len, &max, s[i]);
+    }
+
+  }
+
+  out = mpc_expectf(mpc_set(bits, range, comp), comp ? "none of '%s'" : "one of '%s'", range);
+
+  free(x);
+  free(range);
+
+  return out;
+}
+
+/*
+** Regexes made only of characters, sequences,
+** alternatives and repetition are also compiled
+** to a DFA. The combinators commit to the first
+** alternative that matches and repeat greedily,
+** so the two only agree when every choice can be
+** made on the next character: alternatives start
+** with different characters, only the last may be
+** empty, and nothing optional can start with a
+** character that could follow it. The combinators
+** then always find the longest match, just as the
+** DFA does, backing off to where it last accepted.
+** Anything else keeps the combinators alone.
+*/
+
+enum {
+  MPC_NFA_MAX = 1024,
+  MPC_DFA_MAX = 128
+};
+
+typedef struct {
+  unsigned char set[32];
+  int chars;
+  int out[2];
+} mpc_nfa_state_t;
+
+typedef struct {
+  int num;
+  mpc_nfa_state_t states[MPC_NFA_MAX];
+} mpc_nfa_t;
+
+static void mpc_dfa_set_add(unsigned char *x, const unsigned char *y) {
+  int j;
+  for (j = 0; j < 32; j++) { x[j] |= y[j]; }
+}
+
+static int mpc_dfa_set_meets(const unsigned char *x, const unsigned char *y) {
+  int j;
+  for (j = 0; j < 32; j++) { if (x[j] & y[j]) { return 1; } }
+  return 0;
+}
+
+/* The characters a single character parser accepts, tested as its input function does */
+static int mpc_dfa_set(const mpc_parser_t *p, unsigned char *set) {
+
+  int c;
+  char x;
+
+  memset(set, 0, 32);
+
+  for (c = 1; c < 256; c++) {
+    x = (char)c;
+    switch (p->type) {
+      case MPC_TYPE_ANY: break;
+      case MPC_TYPE_SINGLE: if (x != p->data.single.x) { continue; } break;
+      case MPC_TYPE_RANGE: if (x < p->data.range.x || x > p->data.range.y) { continue; } break;
+      case MPC_TYPE_SET: if (!(p->data.set.bits[c / 8] & (1 << (c % 8)))) { continue; } break;
+      default: return 0;
+    }
+    set[c / 8] |= 1 << (c % 8);
+  }
+
+  return 1;
+}
+
+/*
+** Works out if `p` can be compiled, given the
+** characters that may follow it. A `count` that
+** fails part way does not give back its input,
+** so it must be inside a sequence, which does.
+*/
+static int mpc_dfa_check(const mpc_parser_t *p, int bare, const unsigned char *follow, unsigned char *first, int *nullable) {
+
+  unsigned char f[32], g[32];
+  int j, n;
+
+  if (p->retained) { return 0; }
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT:
+      return mpc_dfa_check(p->data.expect.x, bare, follow, first, nullable);
+
+    case MPC_TYPE_LIFT:
+      memset(first, 0, 32);
+      *nullable = 1;
+      return p->data.lift.lf == mpcf_ctor_str;
+
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold || p->data.and.n == 0) { return 0; }
+      memset(first, 0, 32);
+      *nullable = 1;
+      for (j = p->data.and.n-1; j >= 0; j--) {
+        memcpy(f, first, 32);
+        if (*nullable) { mpc_dfa_set_add(f, follow); }
+        if (!mpc_dfa_check(p->data.and.xs[j], 0, f, g, &n)) { return 0; }
+        if (!n) { memset(first, 0, 32); }
+        mpc_dfa_set_add(first, g);
+        *nullable = *nullable && n;
+      }
+      return 1;
+
+    case MPC_TYPE_OR:
+      memset(first, 0, 32);
+      *nullable = 0;
+      for (j = 0; j < p->data.or.n; j++) {
+        if (*nullable) { return 0; }
+        if (!mpc_dfa_check(p->data.or.xs[j], 1, follow, g, nullable)) { return 0; }
+        if (mpc_dfa_set_meets(first, g)) { return 0; }
+        mpc_dfa_set_add(first, g);
+      }
+      return !(*nullable && mpc_dfa_set_meets(first, follow));
+
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str) { return 0; }
+      if (!mpc_dfa_check(p->data.not.x, 1, follow, first, &n) || n) { return 0; }
+      *nullable = 1;
+      return !mpc_dfa_set_meets(first, follow);
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.f != mpcf_strfold) { return 0; }
+      if (p->type == MPC_TYPE_COUNT && bare && p->data.repeat.n > 1) { return 0; }
+      if (!mpc_dfa_check(p->data.repeat.x, 1, follow, first, &n) || n) { return 0; }
+      memcpy(f, first, 32);
+      mpc_dfa_set_add(f, follow);
+      if (!mpc_dfa_check(p->data.repeat.x, 1, f, g, &n)) { return 0; }
+      if (p->type == MPC_TYPE_COUNT) {
+        *nullable = p->data.repeat.n == 0;
+        if (*nullable) { memset(first, 0, 32); }
+        return 1;
+      }
+      *nullable = p->type == MPC_TYPE_MANY;
+      return !mpc_dfa_set_meets(first, follow);
+
+    default:
+      *nullable = 0;
+      return mpc_dfa_set(p, first);
+  }
+
+}
+
+static int mpc_nfa_state(mpc_nfa_t *a) {
+  if (a->num == MPC_NFA_MAX) { return -1; }
+  memset(&a->states[a->num], 0, sizeof(mpc_nfa_state_t));
+  a->states[a->num].out[0] = -1;
+  a->states[a->num].out[1] = -1;
+  return a->num++;
+}
+
+static int mpc_nfa_build(mpc_nfa_t *a, const mpc_parser_t *p, int *start, int *end);
+
+static int mpc_nfa_many(mpc_nfa_t *a, const mpc_parser_t *x, int *start, int *end) {
+  int s, t;
+  if ((*start = mpc_nfa_state(a)) < 0) { return 0; }
+  if ((*end = mpc_nfa_state(a)) < 0) { return 0; }
+  if (!mpc_nfa_build(a, x, &s, &t)) { return 0; }
+  a->states[*start].out[0] = s;
+  a->states[*start].out[1] = *end;
+  a->states[t].out[0] = *start;
+  return 1;
+}
+
+/*
+** Adds the states for `p` with a Thompson
+** construction. Each piece has one start and
+** ends in an epsilon state left to be joined
+** to whatever comes next.
+*/
+static int mpc_nfa_build(mpc_nfa_t *a, const mpc_parser_t *p, int *start, int *end) {
+
+  int j, s, t, u, v;
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT:
+      return mpc_nfa_build(a, p->data.expect.x, start, end);
+
+    case MPC_TYPE_LIFT:
+      *start = *end = mpc_nfa_state(a);
+      return *start >= 0;
+
+    case MPC_TYPE_AND:
+      if (!mpc_nfa_build(a, p->data.and.xs[0], start, end)) { return 0; }
+      for (j = 1; j < p->data.and.n; j++) {
+        if (!mpc_nfa_build(a, p->data.and.xs[j], &s, &t)) { return 0; }
+        a->states[*end].out[0] = s;
+        *end = t;
+      }
+      return 1;
+
+    case MPC_TYPE_OR:
+      if ((*end = mpc_nfa_state(a)) < 0) { return 0; }
+      u = -1;
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_nfa_build(a, p->data.or.xs[j], &s, &t)) { return 0; }
+        a->states[t].out[0] = *end;
+        v = s;
+        if (j < p->data.or.n-1) {
+          if ((v = mpc_nfa_state(a)) < 0) { return 0; }
+          a->states[v].out[0] = s;
+        }
+        if (u < 0) { *start = v; } else { a->states[u].out[1] = v; }
+        u = v;
+      }
+      return 1;
+
+    case MPC_TYPE_MAYBE:
+      if ((*start = mpc_nfa_state(a)) < 0) { return 0; }
+      if ((*end = mpc_nfa_state(a)) < 0) { return 0; }
+      if (!mpc_nfa_build(a, p->data.not.x, &s, &t)) { return 0; }
+      a->states[*start].out[0] = s;
+      a->states[*start].out[1] = *end;
+      a->states[t].out[0] = *end;
+      return 1;
+
+    case MPC_TYPE_MANY:
+      return mpc_nfa_many(a, p->data.repeat.x, start, end);
+
+    /* The first pass gets its own states so a failure in it is told apart from one in the rest */
+    case MPC_TYPE_MANY1:
+      if (!mpc_nfa_build(a, p->data.repeat.x, start, &t)) { return 0; }
+      if (!mpc_nfa_many(a, p->data.repeat.x, &s, end)) { return 0; }
+      a->states[t].out[0] = s;
+      return 1;
+
+    case MPC_TYPE_COUNT:
+      if ((*start = *end = mpc_nfa_state(a)) < 0) { return 0; }
+      for (j = 0; j < p->data.repeat.n; j++) {
+        if (!mpc_nfa_build(a, p->data.repeat.x, &s, &t)) { return 0; }
+        a->states[*end].out[0] = s;
+        *end = t;
+      }
+      return 1;
+
+    default:
+      if ((*start = mpc_nfa_state(a)) < 0) { return 0; }
+      if ((*end = mpc_nfa_state(a)) < 0) { return 0; }
+      a->states[*start].chars = 1;
+      a->states[*start].out[0] = *end;
+      return mpc_dfa_set(p, a->states[*start].set);
+  }
+
+}
+
+static void mpc_nfa_closure(const mpc_nfa_t *a, unsigned char *set) {
 
-  int mode = *((int*)data);
-  char *s = x;
-  mpc_parser_t *p;
+  int stack[MPC_NFA_MAX];
+  int j, k, o, n = 0;
 
-  /* Any Character */
-  if (s[0] == '.') {
-    free(s);
-    if (mode & MPC_RE_DOTALL) {
-      return mpc_any();
-    } else {
-      return mpc_expect(mpc_noneof("\n"), "any character except a newline");
-    }
+  for (j = 0; j < a->num; j++) {
+    if (set[j / 8] & (1 << (j % 8))) { stack[n++] = j; }
   }
 
-  /* Start of Input */
-  if (s[0] == '^') {
-    free(s);
-    if (mode & MPC_RE_MULTILINE) {
-      return mpc_and(2, mpcf_snd, mpc_or(2, mpc_soi(), mpc_boundary_newline()), mpc_lift(mpcf_ctor_str), free);
-    } else {
-      return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
+  while (n) {
+    j = stack[--n];
+    if (a->states[j].chars) { continue; }
+    for (k = 0; k < 2; k++) {
+      o = a->states[j].out[k];
+      if (o < 0 || set[o / 8] & (1 << (o % 8))) { continue; }
+      set[o / 8] |= 1 << (o % 8);
+      stack[n++] = o;
     }
   }
 
-  /* End of Input */
-  if (s[0] == '$') {
-    free(s);
-    if (mode & MPC_RE_MULTILINE) {
-      return mpc_or(2,
-        mpc_newline(),
-        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
-    } else {
-      return mpc_or(2,
-        mpc_and(2, mpcf_fst, mpc_newline(), mpc_eoi(), free),
-        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
+}
+
+/*
+** Subset construction. States are numbered in the
+** order they are found, so following `parent` back
+** from a state spells out a shortest input that
+** reaches it, one `via` character at a time.
+*/
+static mpc_dfa_t *mpc_dfa_build(const mpc_nfa_t *a, int start, int end, int *parent, char *via) {
+
+  int bytes = (a->num + 7) / 8;
+  unsigned char *sets = calloc(MPC_DFA_MAX, bytes);
+  unsigned char *t = malloc(bytes);
+  mpc_dfa_t *d = calloc(1, sizeof(mpc_dfa_t));
+  int q, c, j, k, any;
+
+  d->next = malloc(sizeof(int) * 256 * MPC_DFA_MAX);
+  d->accept = calloc(MPC_DFA_MAX, 1);
+
+  sets[start / 8] |= 1 << (start % 8);
+  mpc_nfa_closure(a, sets);
+  parent[0] = -1;
+  d->num = 1;
+
+  for (q = 0; q < d->num; q++) {
+
+    d->accept[q] = (sets[q * bytes + end / 8] >> (end % 8)) & 1;
+    d->next[q * 256] = -1;
+
+    for (c = 1; c < 256; c++) {
+
+      memset(t, 0, bytes);
+      any = 0;
+      for (j = 0; j < a->num; j++) {
+        if (!(sets[q * bytes + j / 8] & (1 << (j % 8)))) { continue; }
+        if (!a->states[j].chars) { continue; }
+        if (!(a->states[j].set[c / 8] & (1 << (c % 8)))) { continue; }
+        k = a->states[j].out[0];
+        t[k / 8] |= 1 << (k % 8);
+        any = 1;
+      }
+
+      if (!any) { d->next[q * 256 + c] = -1; continue; }
+
+      mpc_nfa_closure(a, t);
+
+      for (k = 0; k < d->num; k++) {
+        if (memcmp(sets + k * bytes, t, bytes) == 0) { break; }
+      }
+
+      if (k == d->num) {
+        if (d->num == MPC_DFA_MAX) {
+          free(sets); free(t); free(d->next); free(d->accept); free(d);
+          return NULL;
+        }
+        memcpy(sets + k * bytes, t, bytes);
+        parent[k] = q;
+        via[k] = (char)c;
+        d->num++;
+      }
+
+      d->next[q * 256 + c] = k;
     }
   }
 
-  /* Regex Escape */
-  if (s[0] == '\\') {
-    p = mpc_re_escape_char(s[1]);
-    p = (p == NULL) ? mpc_char(s[1]) : p;
-    free(s);
-    return p;
-  }
+  free(sets);
+  free(t);
 
-  /* Regex Standard */
-  p = mpc_char(s[0]);
-  free(s);
-  return p;
+  d->next = realloc(d->next, sizeof(int) * 256 * d->num);
+  d->accept = realloc(d->accept, d->num);
+  d->stop = calloc(d->num, sizeof(mpc_dfa_err_t));
+  return d;
 }
 
-static const char *mpc_re_range_escape_char(char c) {
-  switch (c) {
-    case '-': return "-";
-    case 'a': return "\a";
-    case 'f': return "\f";
-    case 'n': return "\n";
-    case 'r': return "\r";
-    case 't': return "\t";
-    case 'v': return "\v";
-    case 'b': return "\b";
-    case 'd': return "0123456789";
-    case 's': return " \f\n\r\t\v";
-    case 'w': return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
-    default: return NULL;
+static long mpc_dfa_match(const mpc_dfa_t *d, const char *s) {
+  int q = 0;
+  long j, m = d->accept[0] ? 0 : -1;
+  for (j = 0; s[j]; j++) {
+    q = d->next[q * 256 + (unsigned char)s[j]];
+    if (q < 0) { break; }
+    if (d->accept[q]) { m = j + 1; }
   }
+  return m;
 }
 
-static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+/* Keeps the expected list of an error, if it is all at the position it should be */
+static void mpc_dfa_err_keep(mpc_dfa_err_t *x, const mpc_err_t *y, long pos) {
 
-  mpc_parser_t *out;
-  size_t i, j;
-  size_t start, end;
-  const char *tmp = NULL;
-  const char *s = x;
-  int comp = s[0] == '^' ? 1 : 0;
-  char *range = calloc(1,1);
+  int j;
 
-  if (s[0] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
-  if (s[0] == '^' &&
-      s[1] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  x->known = y == NULL || (y->failure == NULL && y->state.pos == pos);
+  x->expected_num = y == NULL ? -1 : 0;
+  x->expected = NULL;
 
-  for (i = comp; i < strlen(s); i++){
+  if (!x->known || y == NULL || y->expected_num == 0) { return; }
 
-    /* Regex Range Escape */
-    if (s[i] == '\\') {
-      tmp = mpc_re_range_escape_char(s[i+1]);
-      if (tmp != NULL) {
-        range = realloc(range, strlen(range) + strlen(tmp) + 1);
-        strcat(range, tmp);
-      } else {
-        range = realloc(range, strlen(range) + 1 + 1);
-        range[strlen(range) + 1] = '\0';
-        range[strlen(range) + 0] = s[i+1];
-      }
-      i++;
-    }
+  x->expected_num = y->expected_num;
+  x->expected = malloc(sizeof(char*) * y->expected_num);
+  for (j = 0; j < y->expected_num; j++) {
+    x->expected[j] = malloc(strlen(y->expected[j]) + 1);
+    strcpy(x->expected[j], y->expected[j]);
+  }
+}
 
-    /* Regex Range...Range */
-    else if (s[i] == '-') {
-      if (s[i+1] == '\0' || i == 0) {
-          range = realloc(range, strlen(range) + strlen("-") + 1);
-          strcat(range, "-");
-      } else {
-        start = s[i-1]+1;
-        end = s[i+1]-1;
-        for (j = start; j <= end; j++) {
-          range = realloc(range, strlen(range) + 1 + 1 + 1);
-          range[strlen(range) + 1] = '\0';
-          range[strlen(range) + 0] = (char)j;
-        }
+/*
+** Finds the errors for each state by running the
+** combinators on the shortest input that ends in
+** it. This also checks that both agree on what
+** those inputs match, giving up if they do not.
+*/
+static int mpc_dfa_replay(mpc_dfa_t *d, const mpc_parser_t *x, const int *parent, const char *via) {
+
+  char *w = malloc(d->num + 1);
+  mpc_input_t *i;
+  mpc_result_t r;
+  mpc_err_t *e;
+  int q, k, n, ok, agree;
+
+  for (q = 0; q < d->num; q++) {
+
+    n = 0;
+    for (k = q; parent[k] >= 0; k = parent[k]) { n++; }
+    w[n] = '\0';
+    for (k = q; parent[k] >= 0; k = parent[k]) { w[--n] = via[k]; }
+    n = strlen(w);
+
+    i = mpc_input_new_string("<mpc_re_compiler>", w);
+    e = NULL;
+    ok = mpc_parse_run(i, x, &r, &e, 0);
+
+    if (ok) {
+      agree = i->state.pos == mpc_dfa_match(d, w);
+      mpc_free(i, r.output);
+      mpc_dfa_err_keep(&d->stop[q], e, n);
+      d->stop[q].known = d->stop[q].known && e != NULL;
+    } else {
+      agree = mpc_dfa_match(d, w) == -1;
+      if (q == 0) {
+        mpc_dfa_err_keep(&d->fail_merged, e, 0);
+        mpc_dfa_err_keep(&d->fail_returned, r.error, 0);
       }
+      mpc_err_delete_internal(i, r.error);
     }
 
-    /* Regex Range Normal */
-    else {
-      range = realloc(range, strlen(range) + 1 + 1);
-      range[strlen(range) + 1] = '\0';
-      range[strlen(range) + 0] = s[i];
-    }
+    mpc_err_delete_internal(i, e);
+    mpc_input_delete(i);
 
+    if (!agree) { free(w); return 0; }
   }
 
-  out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
+  free(w);
+  return 1;
+}
 
-  free(x);
-  free(range);
+static mpc_parser_t *mpc_re_compile(mpc_parser_t *x) {
 
-  return out;
+  unsigned char follow[32], first[32];
+  int nullable, start, end;
+  int parent[MPC_DFA_MAX];
+  char via[MPC_DFA_MAX];
+  mpc_nfa_t *a;
+  mpc_dfa_t *d;
+  mpc_parser_t *p;
+
+  memset(follow, 0, 32);
+  if (!mpc_dfa_check(x, 1, follow, first, &nullable)) { return x; }
+
+  a = calloc(1, sizeof(mpc_nfa_t));
+  d = mpc_nfa_build(a, x, &start, &end) ? mpc_dfa_build(a, start, end, parent, via) : NULL;
+  free(a);
+
+  if (d == NULL) { return x; }
+
+  if (!mpc_dfa_replay(d, x, parent, via)) {
+    mpc_dfa_delete(d);
+    return x;
+  }
+
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.d = d;
+  p->data.dfa.x = x;
+  return p;
 }
 
 mpc_parser_t *mpc_re(const char *re) {
@@ -2417,7 +4032,7 @@ mpc_parser_t *mpc_re_mode(const char *re, int mode) {
 
   mpc_optimise(r.output);
 
-  return r.output;
+  return mpc_re_compile(r.output);
 
 }
 
@@ -2647,16 +4262,21 @@ mpc_val_t *mpcf_all_free(int n, mpc_val_t** xs) {
 
 mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
   int i;
-  size_t l = 0;
+  size_t l = 0, m;
 
   if (n == 0) { return calloc(1, 1); }
 
   for (i = 0; i < n; i++) { l += strlen(xs[i]); }
 
+  m = strlen(xs[0]);
   xs[0] = realloc(xs[0], l + 1);
 
+  /* Copy each on at the end rather than strcat, which rescans from the start */
   for (i = 1; i < n; i++) {
-    strcat(xs[0], xs[i]); free(xs[i]);
+    l = strlen(xs[i]);
+    memcpy((char*)xs[0] + m, xs[i], l + 1);
+    m += l;
+    free(xs[i]);
   }
 
   return xs[0];
@@ -2739,24 +4359,15 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
     free(e);
   }
 
-  if (p->type == MPC_TYPE_ONEOF) {
+  if (p->type == MPC_TYPE_SET) {
     s = mpcf_escape_new(
-      p->data.string.x,
+      p->data.set.x,
       mpc_escape_input_c,
       mpc_escape_output_c);
     printf("[%s]", s);
     free(s);
   }
 
-  if (p->type == MPC_TYPE_NONEOF) {
-    s = mpcf_escape_new(
-      p->data.string.x,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("[^%s]", s);
-    free(s);
-  }
-
   if (p->type == MPC_TYPE_STRING) {
     s = mpcf_escape_new(
       p->data.string.x,
@@ -2769,6 +4380,8 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { mpc_print_unretained(p->data.packrat.x, 0); }
+  if (p->type == MPC_TYPE_DFA)      { mpc_print_unretained(p->data.dfa.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2921,6 +4534,7 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
 
   a->children_num = 0;
   a->children = NULL;
+  a->id = 0;
   return a;
 
 }
@@ -3001,6 +4615,17 @@ mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
   return a;
 }
 
+/*
+** Rule ids are numbered from one and the
+** innermost rule wins, so a node that
+** already has an id keeps it.
+*/
+mpc_ast_t *mpc_ast_add_id(mpc_ast_t *a, int id) {
+  if (a == NULL) { return a; }
+  if (a->id == 0) { a->id = id; }
+  return a;
+}
+
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
   if (a == NULL) { return a; }
   a->state = s;
@@ -3229,6 +4854,7 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
     if        (as[i] && as[i]->children_num == 0) {
       mpc_ast_add_child(r, as[i]);
     } else if (as[i] && as[i]->children_num == 1) {
+      mpc_ast_add_id(as[i]->children[0], as[i]->id);
       mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
       mpc_ast_delete_no_children(as[i]);
     } else if (as[i] && as[i]->children_num >= 2) {
@@ -3294,6 +4920,7 @@ mpc_parser_t *mpca_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.viable = NULL;
 
   va_start(va, n);
   for (i = 0; i < n; i++) {
@@ -3332,6 +4959,25 @@ mpc_parser_t *mpca_and(int n, ...) {
 
 mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
 
+static mpc_val_t *mpcaf_copy_ast(mpc_val_t *x) {
+
+  int i;
+  mpc_ast_t *a = x;
+  mpc_ast_t *b = mpc_ast_new(a->tag, a->contents);
+
+  b->state = a->state;
+  b->id = a->id;
+  b->children_num = a->children_num;
+  b->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+  for (i = 0; i < a->children_num; i++) {
+    b->children[i] = mpcaf_copy_ast(a->children[i]);
+  }
+
+  return b;
+}
+
+mpc_parser_t *mpca_packrat(mpc_parser_t *a) { return mpc_packrat(a, mpcaf_copy_ast, (mpc_dtor_t)mpc_ast_delete); }
+
 /*
 ** Grammar Parser
 */
@@ -3505,6 +5151,19 @@ static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
 
 }
 
+/*
+** A reference to a named rule gives what it
+** returns the rule's id and tag, then a root,
+** all in one parser level so references don't
+** eat into the recursion limit any faster.
+*/
+static mpc_val_t *mpcaf_grammar_ref(mpc_val_t *x, void *p) {
+  mpc_parser_t *q = p;
+  x = mpc_ast_add_id(x, q->id);
+  x = mpc_ast_add_tag(x, q->name);
+  return mpc_ast_add_root(x);
+}
+
 static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
 
   mpca_grammar_st_t *st = s;
@@ -3512,7 +5171,7 @@ static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
   free(x);
 
   if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
+    return mpca_state(mpc_apply_to(p, mpcaf_grammar_ref, p));
   } else {
     return mpca_state(mpca_root(p));
   }
@@ -3581,7 +5240,10 @@ mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
 
   mpc_optimise(r.output);
 
-  return (st->flags & MPCA_LANG_PREDICTIVE) ? mpc_predictive(r.output) : r.output;
+  if (st->flags & MPCA_LANG_PREDICTIVE) { r.output = mpc_predictive(r.output); }
+  if (st->flags & MPCA_LANG_PACKRAT) { r.output = mpca_packrat(r.output); }
+
+  return r.output;
 
 }
 
@@ -3655,12 +5317,21 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
   mpca_stmt_t *stmt;
   mpca_stmt_t **stmts = x;
   mpc_parser_t *left;
+  int id;
 
   while(*stmts) {
     stmt = *stmts;
     left = mpca_grammar_find_parser(stmt->ident, st);
+
+    /* Nodes a rule builds carry one plus its position in the arguments,
+       given to them wherever the rule is referenced */
+    for (id = 0; id < st->parsers_num; id++) {
+      if (st->parsers[id] == left) { break; }
+    }
+    left->id = id + 1;
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
+    if (st->flags & MPCA_LANG_PACKRAT) { stmt->grammar = mpca_packrat(stmt->grammar); }
     mpc_optimise(stmt->grammar);
     mpc_define(left, stmt->grammar);
     free(stmt->ident);
@@ -3832,7 +5503,7 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   st.parsers = NULL;
   st.flags = flags;
 
-  i = mpc_input_new_file(filename, f);
+  i = mpc_input_new_contents(filename, f);
   err = mpca_lang_st(i, &st);
   mpc_input_delete(i);
 
@@ -3855,6 +5526,8 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)  { return 1 + mpc_nodecount_unretained(p->data.packrat.x, 0); }
+  if (p->type == MPC_TYPE_DFA)      { return 1 + mpc_nodecount_unretained(p->data.dfa.x, 0); }
 
   if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
@@ -3892,6 +5565,202 @@ void mpc_stats(mpc_parser_t* p) {
   printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
 }
 
+/*
+** A parser can be run as a span if its output is
+** always the text it consumed. A `count` that fails
+** part way keeps what it consumed, so one directly
+** under something that carries on after a failure
+** would leave text behind that is not in its output.
+*/
+static int mpc_optimise_span_child(const mpc_parser_t *p) {
+  while (!p->retained && p->type == MPC_TYPE_EXPECT) { p = p->data.expect.x; }
+  return p->span && !p->retained && !(p->type == MPC_TYPE_COUNT && p->data.repeat.n > 1);
+}
+
+static int mpc_optimise_span(const mpc_parser_t *p) {
+
+  int i;
+
+  switch (p->type) {
+
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_SET:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_SATISFY:
+    case MPC_TYPE_STRING:
+      return 1;
+
+    case MPC_TYPE_DFA: return p->data.dfa.x->span;
+    case MPC_TYPE_LIFT: return p->data.lift.lf == mpcf_ctor_str;
+
+    case MPC_TYPE_EXPECT:
+      return p->data.expect.x->span && !p->data.expect.x->retained;
+
+    case MPC_TYPE_MAYBE:
+      return p->data.not.lf == mpcf_ctor_str && mpc_optimise_span_child(p->data.not.x);
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      return p->data.repeat.f == mpcf_strfold && mpc_optimise_span_child(p->data.repeat.x);
+
+    case MPC_TYPE_COUNT:
+      return p->data.repeat.f == mpcf_strfold
+        && p->data.repeat.x->span && !p->data.repeat.x->retained;
+
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return 0; }
+      for (i = 0; i < p->data.or.n; i++) {
+        if (!mpc_optimise_span_child(p->data.or.xs[i])) { return 0; }
+      }
+      return 1;
+
+    case MPC_TYPE_AND:
+      if (p->data.and.n == 0 || p->data.and.f != mpcf_strfold) { return 0; }
+      for (i = 0; i < p->data.and.n; i++) {
+        if (!p->data.and.xs[i]->span || p->data.and.xs[i]->retained) { return 0; }
+      }
+      return 1;
+
+    default: return 0;
+  }
+
+}
+
+/*
+** Named parsers are not looked inside, their own
+** values are used instead. These stay unknown until
+** the parser is defined and optimised, so a grammar
+** must not be redefined once parsers using it have
+** been optimised.
+*/
+static int mpc_optimise_lead_of(const mpc_parser_t *p, unsigned char *first) {
+  if (p->lead == MPC_LEAD_UNKNOWN) { memset(first, 0xFF, 32); return 1; }
+  memcpy(first, p->first, 32);
+  return p->lead == MPC_LEAD_NULLABLE;
+}
+
+static int mpc_optimise_lead(const mpc_parser_t *p, unsigned char *first) {
+
+  unsigned char f[32];
+  int j, n;
+  const mpc_parser_t *x = NULL;
+
+  memset(first, 0, 32);
+
+  switch (p->type) {
+
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_SET:
+      mpc_dfa_set(p, first);
+      return MPC_LEAD_CONSUMES;
+
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return MPC_LEAD_NULLABLE; }
+      mpc_set_add(first, p->data.string.x[0]);
+      return MPC_LEAD_CONSUMES;
+
+    case MPC_TYPE_SATISFY:
+      memset(first, 0xFF, 32);
+      return MPC_LEAD_CONSUMES;
+
+    case MPC_TYPE_FAIL: return MPC_LEAD_CONSUMES;
+
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANCHOR:
+    case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI:
+      return MPC_LEAD_NULLABLE;
+
+    case MPC_TYPE_EXPECT:     x = p->data.expect.x;     break;
+    case MPC_TYPE_APPLY:      x = p->data.apply.x;      break;
+    case MPC_TYPE_APPLY_TO:   x = p->data.apply_to.x;   break;
+    case MPC_TYPE_CHECK:      x = p->data.check.x;      break;
+    case MPC_TYPE_CHECK_WITH: x = p->data.check_with.x; break;
+    case MPC_TYPE_PREDICT:    x = p->data.predict.x;    break;
+    case MPC_TYPE_PACKRAT:    x = p->data.packrat.x;    break;
+    case MPC_TYPE_DFA:        x = p->data.dfa.x;        break;
+    case MPC_TYPE_MANY1:      x = p->data.repeat.x;     break;
+
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpc_optimise_lead_of(p->data.not.x, first);
+      return MPC_LEAD_NULLABLE;
+
+    case MPC_TYPE_MANY:
+      mpc_optimise_lead_of(p->data.repeat.x, first);
+      return MPC_LEAD_NULLABLE;
+
+    case MPC_TYPE_COUNT:
+      n = mpc_optimise_lead_of(p->data.repeat.x, first);
+      return n || p->data.repeat.n == 0 ? MPC_LEAD_NULLABLE : MPC_LEAD_CONSUMES;
+
+    case MPC_TYPE_OR:
+      n = p->data.or.n == 0;
+      for (j = 0; j < p->data.or.n; j++) {
+        n = mpc_optimise_lead_of(p->data.or.xs[j], f) || n;
+        mpc_dfa_set_add(first, f);
+      }
+      return n ? MPC_LEAD_NULLABLE : MPC_LEAD_CONSUMES;
+
+    case MPC_TYPE_AND:
+      n = 1;
+      for (j = 0; j < p->data.and.n && n; j++) {
+        n = mpc_optimise_lead_of(p->data.and.xs[j], f);
+        mpc_dfa_set_add(first, f);
+      }
+      return n ? MPC_LEAD_NULLABLE : MPC_LEAD_CONSUMES;
+
+    default: return MPC_LEAD_UNKNOWN;
+  }
+
+  n = mpc_optimise_lead_of(x, first);
+  return n ? MPC_LEAD_NULLABLE : MPC_LEAD_CONSUMES;
+}
+
+/*
+** For each character, the alternatives of an `or`
+** that may start with it. Only built when every
+** alternative must consume to succeed, so that
+** the rest can be passed over. Characters any
+** alternative may start with are left empty, as
+** then all of them are tried anyway.
+*/
+static void mpc_optimise_dispatch(mpc_parser_t *p) {
+
+  unsigned char f[32];
+  unsigned long all;
+  int j, c;
+
+  free(p->data.or.viable);
+  p->data.or.viable = NULL;
+
+  if (p->data.or.n < 2 || p->data.or.n > 32) { return; }
+
+  for (j = 0; j < p->data.or.n; j++) {
+    if (mpc_optimise_lead_of(p->data.or.xs[j], f)) { return; }
+  }
+
+  p->data.or.viable = calloc(256, sizeof(unsigned long));
+  all = 0xFFFFFFFFUL >> (32 - p->data.or.n);
+
+  for (j = 0; j < p->data.or.n; j++) {
+    mpc_optimise_lead_of(p->data.or.xs[j], f);
+    for (c = 1; c < 256; c++) {
+      if (f[c / 8] & (1 << (c % 8))) { p->data.or.viable[c] |= 1UL << j; }
+    }
+  }
+
+  for (c = 0; c < 256; c++) {
+    if (p->data.or.viable[c] == all) { p->data.or.viable[c] = 0; }
+  }
+}
+
 static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
 
   int i, n, m;
@@ -3907,6 +5776,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
   if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_unretained(p->data.check_with.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_PACKRAT)    { mpc_optimise_unretained(p->data.packrat.x, 0); }
   if (p->type == MPC_TYPE_NOT)        { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_unretained(p->data.not.x, 0); }
   if (p->type == MPC_TYPE_MANY)       { mpc_optimise_unretained(p->data.repeat.x, 0); }
@@ -3938,7 +5808,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.n = n + m - 1;
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.viable); free(t->name); free(t);
       continue;
     }
 
@@ -3952,7 +5822,7 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
       memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
       memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
+      free(t->data.or.xs); free(t->data.or.viable); free(t->name); free(t);
       continue;
     }
 
@@ -4055,10 +5925,14 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
       continue;
     }
 
-    return;
+    break;
 
   }
 
+  p->span = mpc_optimise_span(p);
+  p->lead = mpc_optimise_lead(p, p->first);
+  if (p->type == MPC_TYPE_OR) { mpc_optimise_dispatch(p); }
+
 }
 
 void mpc_optimise(mpc_parser_t *p) {
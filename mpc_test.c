@@ -0,0 +1,669 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>
+
+/* The interpreter is built in, with its main renamed, so its parts can
+   be checked directly */
+#define main lispy_main
+#include "s_expressions.c"
+#undef main
+
+/*
+ * Regression checks for mpc and the lispy interpreter. Each check parses
+ * or evaluates some input and compares the output, or the printed error,
+ * with what is expected.
+ *
+ *   cc -std=c99 -Wall mpc_test.c mpc.c -ledit -lm -lpthread -o mpc_test
+ *   ./mpc_test
+ */
+
+static int failures = 0;
+
+/* Parse "input" with "p", giving the output string or the error message */
+static char* parse_string(mpc_parser_t* p, char* input) {
+  mpc_result_t r;
+  char* s;
+  if (mpc_parse("<test>", input, p, &r)) {
+    s = r.output;
+  } else {
+    s = mpc_err_string(r.error);
+    mpc_err_delete(r.error);
+  }
+  return s;
+}
+
+static void check_string(char* name, mpc_parser_t* p, char* input, char* expected) {
+  char* s = parse_string(p, input);
+  if (strcmp(s, expected) != 0) {
+    printf("FAIL %s: '%s'\n  expected: %s\n  got:      %s\n", name, input, expected, s);
+    failures++;
+  }
+  free(s);
+}
+
+/* A count of zero matches nothing, and must not stop what follows */
+static void test_count_zero(void) {
+
+  mpc_parser_t* re0 = mpc_re("ab{0}c");
+  mpc_parser_t* re1 = mpc_re("a{0}[a-c]");
+  mpc_parser_t* re2 = mpc_re("x|a{0}[a-c]");
+  mpc_parser_t* re3 = mpc_re("^b{0}$");
+
+  check_string("count zero", re0, "ac", "ac");
+  check_string("count zero", re1, "b", "b");
+  check_string("count zero", re2, "c", "c");
+  check_string("count zero", re2, "d",
+    "<test>:1:1: error: expected 'x' or one of 'abc' at 'd'\n");
+  check_string("count zero", re3, "", "");
+
+  mpc_delete(re0);
+  mpc_delete(re1);
+  mpc_delete(re2);
+  mpc_delete(re3);
+}
+
+/* Regexes that compile to a DFA, and character sets matched against a
+   bitmap, must give the output and errors the original mpc gave */
+static void test_regex_errors(void) {
+
+  static char* cases[][3] = {
+    { "-?[0-9]+", "-12", "-12" },
+    { "-?[0-9]+", "-x", "<test>:1:2: error: expected one or more of one of '0123456789' at 'x'\n" },
+    { "-?[0-9]+", "", "<test>:1:1: error: expected '-' or one or more of one of '0123456789' at end of input\n" },
+    { "ab|cd", "cd", "cd" },
+    { "ab|cd", "ac", "<test>:1:2: error: expected 'b' at 'c'\n" },
+    { "ab|cd", "x", "<test>:1:1: error: expected 'a' or 'c' at 'x'\n" },
+    { "[a-c]+x", "abcx", "abcx" },
+    { "[a-c]+x", "abcy", "<test>:1:4: error: expected one of 'abc' or 'x' at 'y'\n" },
+    { "[a-c]+x", "x", "<test>:1:1: error: expected one or more of one of 'abc' at 'x'\n" },
+    { "a(b|c)d", "acd", "acd" },
+    { "a(b|c)d", "abx", "<test>:1:3: error: expected 'd' at 'x'\n" },
+    { "x[0-9]*y", "x12z", "<test>:1:4: error: expected one of '0123456789' or 'y' at 'z'\n" },
+    { "(ab)+", "ababa", "abab" },
+    { "(ab)+c", "ababd", "<test>:1:5: error: expected 'a' or 'c' at 'd'\n" },
+    { "[^a-c]", "d", "d" },
+    { "[^a-c]", "b", "<test>:1:1: error: expected none of 'abc' at 'b'\n" },
+    { "[^a-c]", "", "<test>:1:1: error: expected none of 'abc' at end of input\n" },
+    { "[a-cx-z]", "y", "y" },
+    { "[a-cx-z]", "m", "<test>:1:1: error: expected one of 'abcxyz' at 'm'\n" },
+    { "[0-9a-f]+", "3fg", "3f" },
+  };
+  mpc_parser_t* oneof = mpc_oneof("abc");
+  mpc_parser_t* noneof = mpc_noneof("abc");
+  size_t j;
+
+  for (j = 0; j < sizeof(cases) / sizeof(cases[0]); j++) {
+    mpc_parser_t* re = mpc_re(cases[j][0]);
+    check_string(cases[j][0], re, cases[j][1], cases[j][2]);
+    mpc_delete(re);
+  }
+
+  check_string("oneof", oneof, "b", "b");
+  check_string("oneof", oneof, "d", "<test>:1:1: error: expected one of 'abc' at 'd'\n");
+  check_string("oneof", oneof, "", "<test>:1:1: error: expected one of 'abc' at end of input\n");
+  check_string("noneof", noneof, "d", "d");
+  check_string("noneof", noneof, "b", "<test>:1:1: error: expected none of 'abc' at 'b'\n");
+  check_string("noneof", noneof, "", "<test>:1:1: error: expected none of 'abc' at end of input\n");
+
+  mpc_delete(oneof);
+  mpc_delete(noneof);
+}
+
+/* The lispy grammar from s_expressions.c, built with "flags" */
+static mpc_parser_t* lispy_new(int flags, mpc_parser_t** rules) {
+  rules[0] = mpc_new("number");
+  rules[1] = mpc_new("symbol");
+  rules[2] = mpc_new("sexpr");
+  rules[3] = mpc_new("expr");
+  rules[4] = mpc_new("lispy");
+  mpc_err_t* e = mpca_lang(flags,
+    " number : /-?[0-9]+/ ;                    "
+    " symbol : '+' | '-' | '*' | '/' ;         "
+    " sexpr  : '(' <expr>* ')' ;               "
+    " expr   : <number> | <symbol> | <sexpr> ; "
+    " lispy  : /^/ <expr>* /$/ ;               ",
+    rules[0], rules[1], rules[2], rules[3], rules[4], NULL);
+  if (e) {
+    mpc_err_print(e);
+    mpc_err_delete(e);
+    failures++;
+  }
+  return rules[4];
+}
+
+static void lispy_delete(mpc_parser_t** rules) {
+  mpc_cleanup(5, rules[0], rules[1], rules[2], rules[3], rules[4]);
+}
+
+/* Dispatching an or on the next character must leave errors as the
+   original mpc gave them, with or without MPCA_LANG_PREDICTIVE */
+static void test_dispatch_errors(void) {
+
+  static char* lispy_cases[][3] = {
+    { "(+ 1 x)",
+      "<test>:1:6: error: expected '-', one or more of one of '0123456789', '+', '*', '/', '(' or ')' at 'x'\n",
+      "<test>:1:6: error: expected '-', one or more of one of '0123456789', '+', '*', '/', '(', ')', newline or end of input at 'x'\n" },
+    { ")",
+      "<test>:1:1: error: expected '-', one or more of one of '0123456789', '+', '*', '/', '(', newline or end of input at ')'\n",
+      "<test>:1:1: error: expected '-', one or more of one of '0123456789', '+', '*', '/', '(', newline or end of input at ')'\n" },
+    { "(* (- 2) ]",
+      "<test>:1:10: error: expected '-', one or more of one of '0123456789', '+', '*', '/', '(' or ')' at ']'\n",
+      "<test>:1:6: error: expected one or more of one of '0123456789', '+', '-', '*', '/', '(', ')', newline or end of input at space\n" },
+    { "(+ 1 2)\n(- 3 (",
+      "<test>:2:7: error: expected '-', one or more of one of '0123456789', '+', '*', '/', '(' or ')' at end of input\n",
+      "<test>:2:3: error: expected one or more of one of '0123456789', '+', '-', '*', '/', '(', ')', newline or end of input at space\n" },
+  };
+  static char* stmt_cases[][2] = {
+    { "let x 1;", "<test>:1:7: error: expected '=' at '1'\n" },
+    { "! 1;", "<test>:1:3: error: expected one or more of one of 'abcdefghijklmnopqrstuvwxyz' at '1'\n" },
+    { "# x;", "<test>:1:3: error: expected one or more of one of '0123456789' at 'x'\n" },
+    { "?", "<test>:1:1: error: expected \"let\", '!' or '#' at '?'\n" },
+    { "#1", "<test>:1:3: error: expected one of '0123456789' or ';' at end of input\n" },
+  };
+  mpc_parser_t* rules[5];
+  mpc_parser_t* ident = mpc_new("ident");
+  mpc_parser_t* num = mpc_new("num");
+  mpc_parser_t* stmt = mpc_new("stmt");
+  mpc_parser_t* lispy;
+  size_t j;
+  int k;
+
+  for (k = 0; k < 2; k++) {
+    lispy = lispy_new(k ? MPCA_LANG_PREDICTIVE : MPCA_LANG_DEFAULT, rules);
+    for (j = 0; j < sizeof(lispy_cases) / sizeof(lispy_cases[0]); j++) {
+      check_string("lispy errors", lispy, lispy_cases[j][0], lispy_cases[j][1 + k]);
+    }
+    lispy_delete(rules);
+  }
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+    " ident : /[a-z]+/ ;                                                    "
+    " num   : /[0-9]+/ ;                                                    "
+    " stmt  : \"let\" <ident> '=' <num> ';' | '!' <ident> ';' | '#' <num> ';' ; ",
+    ident, num, stmt, NULL);
+  for (j = 0; j < sizeof(stmt_cases) / sizeof(stmt_cases[0]); j++) {
+    check_string("stmt errors", stmt, stmt_cases[j][0], stmt_cases[j][1]);
+  }
+  mpc_cleanup(3, ident, num, stmt);
+}
+
+/* "depth" nested sums, (+ 1 (+ 1 ... 1)) */
+static char* nested_input(int depth) {
+  char* s = malloc(7 * depth + 2);
+  int j, n = 0;
+  for (j = 0; j < depth; j++) { memcpy(s + n, "(+ 1 ", 5); n += 5; }
+  s[n++] = '1';
+  for (j = 0; j < depth; j++) { s[n++] = ')'; }
+  s[n] = '\0';
+  return s;
+}
+
+/* The deepest nesting the original mpc accepted must still parse,
+   so rule ids can't cost a level of the recursion limit */
+static void test_nesting_depth(void) {
+
+  static const int flags[] = { MPCA_LANG_DEFAULT, MPCA_LANG_PREDICTIVE };
+  static const int depths[] = { 108, 88 };
+  mpc_parser_t* rules[5];
+  int k;
+
+  for (k = 0; k < 2; k++) {
+    mpc_parser_t* lispy = lispy_new(flags[k], rules);
+    char* input = nested_input(depths[k]);
+    mpc_result_t r;
+    if (mpc_parse("<test>", input, lispy, &r)) {
+      mpc_ast_delete(r.output);
+    } else {
+      printf("FAIL nesting depth: %i levels with flags %i\n", depths[k], flags[k]);
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+      failures++;
+    }
+    free(input);
+    lispy_delete(rules);
+  }
+}
+
+static int term_runs = 0;
+
+static mpc_parser_t* ast_char(char c) {
+  return mpc_apply(mpc_char(c), mpcf_str_ast);
+}
+
+static mpc_val_t* term_count(mpc_val_t* x) {
+  term_runs++;
+  return x;
+}
+
+/* Each alternative of "expr" parses "term" again before failing, so
+   without memoising the work triples with every level of brackets.
+   Packrat should parse each bracket's term once. */
+static void test_packrat_backtrack(void) {
+
+  enum { DEPTH = 24 };
+  mpc_parser_t* expr = mpc_new("expr");
+  mpc_parser_t* term = mpc_new("term");
+  char input[2 * DEPTH + 2];
+  mpc_result_t r;
+  int j;
+
+  mpc_define(expr, mpca_packrat(mpca_or(3,
+    mpca_and(3, term, ast_char('+'), expr),
+    mpca_and(3, term, ast_char('-'), expr),
+    term)));
+  mpc_define(term, mpca_packrat(mpc_apply(mpca_or(2,
+    ast_char('1'),
+    mpca_and(3, ast_char('('), expr, ast_char(')'))), term_count)));
+
+  for (j = 0; j < DEPTH; j++) { input[j] = '('; input[DEPTH + 1 + j] = ')'; }
+  input[DEPTH] = '1';
+  input[2 * DEPTH + 1] = '\0';
+
+  if (mpc_parse("<test>", input, expr, &r)) {
+    mpc_ast_delete(r.output);
+  } else {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    failures++;
+  }
+
+  if (term_runs != DEPTH + 1) {
+    printf("FAIL packrat backtrack: term ran %i times for %i brackets\n",
+      term_runs, DEPTH);
+    failures++;
+  }
+
+  mpc_cleanup(2, expr, term);
+}
+
+/* Random lispy input, with a character changed in some so they fail */
+static char* batch_input(unsigned long* seed) {
+  int len = 1 + (int)(*seed % 400), depth = 0, j;
+  char* s = malloc(2 * len + 1);
+  for (j = 0; j < len; j++) {
+    *seed = *seed * 6364136223846793005UL + 1442695040888963407UL;
+    switch ((*seed >> 33) % 8) {
+      case 0: s[j] = '('; depth++; break;
+      case 1: s[j] = depth > 0 ? ')' : ' '; depth -= depth > 0; break;
+      case 2: s[j] = "+-*/"[(*seed >> 40) % 4]; break;
+      case 3: s[j] = ' '; break;
+      default: s[j] = '0' + (char)((*seed >> 40) % 10); break;
+    }
+  }
+  while (depth-- > 0) { s[len++] = ')'; }
+  s[len] = '\0';
+  if ((*seed >> 50) % 3 == 0) { s[(*seed >> 20) % len] = "()x"[(*seed >> 45) % 3]; }
+  return s;
+}
+
+/* Every result of a batch, on any number of threads, must match
+   parsing each input on its own with mpc_parse */
+static void check_batch(char* name, mpc_parser_t* p, const char** inputs, int n) {
+
+  static const int threads[] = { 1, 2, 4, 8 };
+  mpc_result_t* serial = malloc(sizeof(mpc_result_t) * n);
+  int* serial_ok = malloc(sizeof(int) * n);
+  mpc_result_t* batch = malloc(sizeof(mpc_result_t) * n);
+  int* batch_ok = malloc(sizeof(int) * n);
+  int j, t;
+
+  for (j = 0; j < n; j++) {
+    serial_ok[j] = mpc_parse("<batch>", inputs[j], p, &serial[j]);
+  }
+
+  for (t = 0; t < 4; t++) {
+
+    int count = mpc_parse_batch("<batch>", inputs, n, threads[t], p, batch, batch_ok);
+    int expected = 0, same = 1;
+
+    for (j = 0; j < n; j++) {
+      expected += serial_ok[j];
+      if (batch_ok[j] != serial_ok[j]) {
+        same = 0;
+      } else if (batch_ok[j]) {
+        same = mpc_ast_eq(batch[j].output, serial[j].output);
+      } else {
+        char* x = mpc_err_string(batch[j].error);
+        char* y = mpc_err_string(serial[j].error);
+        same = strcmp(x, y) == 0;
+        free(x); free(y);
+      }
+      if (batch_ok[j]) { mpc_ast_delete(batch[j].output); }
+      else { mpc_err_delete(batch[j].error); }
+      if (!same) {
+        printf("FAIL %s: input %i differs with %i threads\n", name, j, threads[t]);
+        failures++;
+        break;
+      }
+    }
+
+    for (j = j + 1; j < n; j++) {
+      if (batch_ok[j]) { mpc_ast_delete(batch[j].output); }
+      else { mpc_err_delete(batch[j].error); }
+    }
+
+    if (count != expected) {
+      printf("FAIL %s: %i of %i parsed with %i threads, expected %i\n",
+        name, count, n, threads[t], expected);
+      failures++;
+    }
+  }
+
+  for (j = 0; j < n; j++) {
+    if (serial_ok[j]) { mpc_ast_delete(serial[j].output); }
+    else { mpc_err_delete(serial[j].error); }
+  }
+  free(serial); free(serial_ok);
+  free(batch); free(batch_ok);
+}
+
+/* One grammar shared by every thread of mpc_parse_batch */
+static void test_parse_batch(void) {
+
+  static const int flags[] = {
+    MPCA_LANG_DEFAULT, MPCA_LANG_PREDICTIVE, MPCA_LANG_PACKRAT };
+  static char* names[] = { "batch", "batch predictive", "batch packrat" };
+  enum { N = 500 };
+  const char* inputs[N];
+  unsigned long seed = 7;
+  int j, k;
+
+  for (j = 0; j < N; j++) { inputs[j] = batch_input(&seed); }
+
+  for (k = 0; k < 3; k++) {
+    mpc_parser_t* rules[5];
+    check_batch(names[k], lispy_new(flags[k], rules), inputs, N);
+    lispy_delete(rules);
+  }
+
+  for (j = 0; j < N; j++) { free((char*)inputs[j]); }
+}
+
+/* The interpreter's parsers, as its main builds them */
+static mpc_parser_t* lispy_rules[5];
+static mpc_parser_t* lispy_term;
+static mpc_parser_t* lispy_line;
+
+/* Everything the interpreter prints for "input" read with "reader",
+   evaluating each expression in turn as lval_batch does */
+static char* lispy_run(int reader, char* input) {
+
+  FILE* f = tmpfile();
+  int out = dup(1);
+  long n;
+  char* s;
+
+  fflush(stdout);
+  dup2(fileno(f), 1);
+
+  if (reader == READ_STREAM) {
+    int stats = 0;
+    lstream st;
+    lstream_init(&st, "<test>", lval_stream_emit, &stats);
+    lstream_feed(&st, input, strlen(input));
+    lstream_end(&st);
+  } else {
+    mpc_result_t r;
+    int ok = reader == READ_HAND ? lval_parse("<test>", input, &r)
+      : mpc_parse("<test>", input,
+        reader == READ_DIRECT ? lispy_line : lispy_rules[4], &r);
+    if (!ok) {
+      mpc_err_print(r.error);
+      mpc_err_delete(r.error);
+    } else if (reader != READ_AST) {
+      lval* v = r.output;
+      for (int i = 0; i < v->count; i++) {
+        lval_emit(lval_eval_top(v->cell[i]), 0);
+      }
+      v->count = 0;
+      lval_del(v);
+    } else {
+      mpc_ast_t* t = r.output;
+      for (int i = 0; i < t->children_num; i++) {
+        if (t->children[i]->id == 0) { continue; }
+        lval_emit(lval_eval_top(lval_read(t->children[i])), 0);
+      }
+      mpc_ast_delete(t);
+    }
+  }
+
+  fflush(stdout);
+  dup2(out, 1);
+  close(out);
+
+  n = ftell(f);
+  s = malloc(n + 1);
+  rewind(f);
+  s[fread(s, 1, n, f)] = '\0';
+  fclose(f);
+  return s;
+}
+
+static void check_lispy(char* name, int reader, char* input, char* expected) {
+  char* s = lispy_run(reader, input);
+  if (strcmp(s, expected) != 0) {
+    printf("FAIL %s: '%s'\n  expected: %s\n  got:      %s\n", name, input, expected, s);
+    failures++;
+  }
+  free(s);
+}
+
+/* Arithmetic past the range of a long carries on in bignums, including
+   division by a divisor of several limbs */
+static void test_bignum(void) {
+
+  static char* cases[][2] = {
+    { "(* 4294967296 4294967296)", "18446744073709551616\n" },
+    { "(+ 9223372036854775807 1)", "9223372036854775808\n" },
+    { "(- -9223372036854775807 2)", "-9223372036854775809\n" },
+    { "(- (- -9223372036854775807 1))", "9223372036854775808\n" },
+    { "(/ (- -9223372036854775807 1) -1)", "9223372036854775808\n" },
+    { "(- (+ 9223372036854775807 1) 1)", "9223372036854775807\n" },
+    { "(* 99999999999 99999999999 99999999999)", "999999999970000000000299999999999\n" },
+    { "(/ (* 123456789012345678 987654321098765432 1000) (* 987654321098765432 1000))",
+      "123456789012345678\n" },
+    { "(/ (* 4294967296 4294967296 4294967296 4294967296) (+ (* 4294967296 4294967296) 1))",
+      "18446744073709551615\n" },
+    /* The quotient digit estimate is one too large and must be added back */
+    { "(/ (+ (* 4294967296 4294967296 2147483648) 3) (+ (* 4294967296 4294967296 536870912) 1))",
+      "3\n" },
+    { "(/ (- 0 (* 4294967296 4294967296 3)) 7)", "-7905747460161236406\n" },
+    { "(/ (* 4294967296 4294967296) 0)", "Error: Division By Zero.\n" },
+  };
+  size_t j;
+
+  for (j = 0; j < sizeof(cases) / sizeof(cases[0]); j++) {
+    check_lispy("bignum", READ_AST, cases[j][0], cases[j][1]);
+  }
+}
+
+/* Every sum kernel wraps just like adding one by one, at every length
+   around the vector widths, and --checked turns overflow into an error */
+static void test_sum_kernels(void) {
+
+  enum { N = 80 };
+  long xs[N];
+  unsigned long x = 0;
+  char input[N * 20 + 8];
+  int j, n = 0;
+
+  for (j = 0; j < N; j++) {
+    xs[j] = j % 7 == 0 ? LONG_MAX : j % 5 == 0 ? LONG_MIN : (long)j * -1234567;
+  }
+
+  for (j = 0; j <= N; j++) {
+    if (j > 0) { x += (unsigned long)xs[j - 1]; }
+    if (lval_sum_scalar(xs, j) != (long)x) {
+      printf("FAIL sum kernels: scalar sum of %i\n", j);
+      failures++;
+    }
+#ifdef LVAL_SIMD_X86
+    if (lval_sum_sse2(xs, j) != (long)x) {
+      printf("FAIL sum kernels: SSE2 sum of %i\n", j);
+      failures++;
+    }
+    if (__builtin_cpu_supports("avx2") && lval_sum_avx2(xs, j) != (long)x) {
+      printf("FAIL sum kernels: AVX2 sum of %i\n", j);
+      failures++;
+    }
+#endif
+  }
+
+  /* More arguments than fit the gather buffer, whose sum overflows */
+  n += sprintf(input + n, "(+");
+  for (j = 0; j < 70; j++) { n += sprintf(input + n, " 200000000000000000"); }
+  sprintf(input + n, ")");
+
+  check_lispy("sum", READ_AST, input, "14000000000000000000\n");
+  check_lispy("sum", READ_AST, "(+ 1 2 3 4 5 6 7 8 9 10 -11)", "44\n");
+
+  lval_checked = 1;
+  check_lispy("checked", READ_AST, input, "Error: Integer Overflow.\n");
+  check_lispy("checked", READ_AST, "(+ 9223372036854775807 1)", "Error: Integer Overflow.\n");
+  check_lispy("checked", READ_AST, "(* 4294967296 4294967296)", "Error: Integer Overflow.\n");
+  check_lispy("checked", READ_AST, "(- (- -9223372036854775807 1))", "Error: Integer Overflow.\n");
+  check_lispy("checked", READ_AST, "(+ 1 2 3 4 5 6 7 8 9 10 -11)", "44\n");
+  lval_checked = 0;
+}
+
+/* The direct, hand written and stream readers print just what the AST
+   reader does for the same input */
+static void test_readers(void) {
+
+  static char* inputs[] = {
+    "(+ 1 2) (* 3 (- 4 5)) -7 (/ 10 0) ()",
+    "  (- 5)\n\n(+ 1\n  (* 2 3))\n(* 4294967296 4294967296)\n",
+    "(+ 1 (+ 2 (+ 3 (+ 4 (+ 5 6))))) + (1 2)",
+  };
+  static char* errors[] = { "(+ 1 x)", "(+ 1 2))", "(* 2\n(- 3", "" };
+  static const int readers[] = { READ_DIRECT, READ_HAND, READ_STREAM };
+  size_t j;
+  int k;
+
+  for (j = 0; j < sizeof(inputs) / sizeof(inputs[0]); j++) {
+    char* expected = lispy_run(READ_AST, inputs[j]);
+    for (k = 0; k < 3; k++) { check_lispy("readers", readers[k], inputs[j], expected); }
+    free(expected);
+  }
+
+  /* The stream reader evaluates what comes before an error, so only the
+     whole input readers give the same output there */
+  for (j = 0; j < sizeof(errors) / sizeof(errors[0]); j++) {
+    char* expected = lispy_run(READ_AST, errors[j]);
+    for (k = 0; k < 2; k++) { check_lispy("reader errors", readers[k], errors[j], expected); }
+    free(expected);
+  }
+}
+
+static int lcache_compiled(void) {
+  int n = 0;
+  for (int j = 0; j < LCACHE_SLOTS; j++) { n += lcache[j].code != NULL; }
+  return n;
+}
+
+/* Repeated top level forms are run from cached bytecode and give the
+   same result as the first walk */
+static void test_lcache(void) {
+
+  int n = lcache_compiled();
+
+  check_lispy("lcache", READ_AST,
+    "(+ 11 (* 12 13)) (+ 11 (* 12 13)) (+ 11 (* 12 13)) (+ 11 (* 12 13))",
+    "167\n167\n167\n167\n");
+  check_lispy("lcache", READ_AST,
+    "(- (/ 14 0) 1) (- (/ 14 0) 1) (- (/ 14 0) 1)",
+    "Error: Division By Zero.\nError: Division By Zero.\nError: Division By Zero.\n");
+  check_lispy("lcache", READ_AST,
+    "(* 4294967296 (+ 4294967296 0)) (* 4294967296 (+ 4294967296 0)) (* 4294967296 (+ 4294967296 0))",
+    "18446744073709551616\n18446744073709551616\n18446744073709551616\n");
+  check_lispy("lcache", READ_AST,
+    "(- 15) (- 15) (- 15) (+ 1 (-)) (+ 1 (-)) (+ 1 (-))",
+    "-15\n-15\n-15\nError: Cannot operate on non-number!\n"
+    "Error: Cannot operate on non-number!\nError: Cannot operate on non-number!\n");
+
+  if (lcache_compiled() <= n) {
+    printf("FAIL lcache: no repeated form was compiled\n");
+    failures++;
+  }
+}
+
+/* "(op 1 1 ... 1 last)" with enough nodes to be handed to another thread */
+static int lispy_wide(char* s, char* op, char* last) {
+  int j, n = sprintf(s, "(%s", op);
+  for (j = 0; j < LPAR_MIN_NODES; j++) { n += sprintf(s + n, " 1"); }
+  return n + sprintf(s + n, " %s)", last);
+}
+
+/* Running on several threads gives what running serially does, and when
+   several children fail the first of them still wins */
+static void test_threads(void) {
+
+  char* input = malloc(32 * LPAR_MIN_NODES);
+  char* expected;
+  int j, n = 0;
+
+  n += sprintf(input + n, "(+ ");
+  n += lispy_wide(input + n, "+", "1");
+  n += lispy_wide(input + n, "+", "(/ 1 0)");
+  n += lispy_wide(input + n, "*", "1");
+  n += lispy_wide(input + n, "+", "+");
+  n += sprintf(input + n, ")\n(+ ");
+  n += lispy_wide(input + n, "+", "+");
+  n += lispy_wide(input + n, "+", "1");
+  n += lispy_wide(input + n, "+", "(/ 1 0)");
+  n += sprintf(input + n, ")\n(* ");
+  n += lispy_wide(input + n, "+", "1");
+  n += lispy_wide(input + n, "-", "1");
+  n += lispy_wide(input + n, "+", "(- 1)");
+  sprintf(input + n, ")\n");
+
+  expected = lispy_run(READ_HAND, input);
+  if (strcmp(expected,
+    "Error: Division By Zero.\nError: Cannot operate on non-number!\n-16711425\n") != 0) {
+    printf("FAIL threads: serial run gave\n%s", expected);
+    failures++;
+  }
+
+  lpar_init(4);
+  for (j = 0; j < 20; j++) { check_lispy("threads", READ_HAND, input, expected); }
+
+  free(expected);
+  free(input);
+}
+
+static void test_lispy(void) {
+
+  sym_init();
+  lval_sum_init();
+  lispy_new(MPCA_LANG_DEFAULT, lispy_rules);
+  lispy_term = mpc_new("expr");
+  lispy_line = lval_reader(lispy_term);
+
+  test_bignum();
+  test_sum_kernels();
+  test_readers();
+  test_lcache();
+  /* Last, as the worker threads can't be stopped again */
+  test_threads();
+
+  lispy_delete(lispy_rules);
+  mpc_cleanup(2, lispy_term, lispy_line);
+}
+
+int main(void) {
+
+  test_count_zero();
+  test_regex_errors();
+  test_nesting_depth();
+  test_dispatch_errors();
+  test_packrat_backtrack();
+  test_parse_batch();
+  test_lispy();
+
+  if (failures) {
+    printf("%i check(s) failed\n", failures);
+    return 1;
+  }
+  puts("all checks passed");
+  return 0;
+}
@@ -2,6 +2,16 @@
 
 #include "mpc.h"
 
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define LVAL_SIMD_X86
+#endif
+
 #ifdef _WIN32
 
 static char buffer[2048];
@@ -28,29 +38,277 @@ void add_history(char* unused) {}
 // --------------------------------------------------------------------
 
 
-/* Add SYM and SEXPR as possible lval types */
-enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_SEXPR };
+/* Add SYM and SEXPR as possible lval types, and BIG for numbers beyond a long */
+enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_SEXPR, LVAL_BIG };
 
+/* Only one of these is in use at a time so they share storage */
 typedef struct lval {
   int type;
-  long num;
-  /* Error and Symbol types have some string data */
-  char* err;
-  char* sym;
-  /* Count and Pointer to a list of "lval*"; */
+  /* Count and allocated capacity of a Sexpr's list of "lval*".
+     For a Big the count is its number of limbs, negated when negative. */
   int count;
-  struct lval** cell;
+  int cap;
+  /* Index of the thread whose pool the node belongs to */
+  int owner;
+  union {
+    /* Numbers too large to fit in a tagged pointer */
+    long num;
+    /* Error type has some string data */
+    char* err;
+    struct lval** cell;
+    /* Big magnitude in base 2^32, least significant limb first */
+    uint32_t* limbs;
+    /* Link to the next free node while the node is in a pool */
+    struct lval* next_free;
+  };
 } lval;
 
+/*
+ * Small numbers and symbols never touch the heap. Heap lvals are at least
+ * 4 byte aligned, so the low two bits of an "lval*" are free to say what
+ * it holds:
+ *
+ *   ...1   a number shifted left by one
+ *   ..10   a symbol id shifted left by two
+ *   ..00   a pointer to a heap lval
+ */
+#define LVAL_FIX_MIN (LONG_MIN / 2)
+#define LVAL_FIX_MAX (LONG_MAX / 2)
+
+int lval_is_heap(lval* v) { return ((uintptr_t)v & 3) == 0; }
+
+int lval_type(lval* v) {
+  if ((uintptr_t)v & 1) { return LVAL_NUM; }
+  if ((uintptr_t)v & 2) { return LVAL_SYM; }
+  return v->type;
+}
+
+long lval_to_num(lval* v) {
+  if ((uintptr_t)v & 1) { return (long)((intptr_t)v >> 1); }
+  return v->num;
+}
+
+int lval_to_sym(lval* v) { return (int)((uintptr_t)v >> 2); }
+
+
+// -------------------------------------------------------------------
+// ------------------------  SYMBOL TABLE ------------------------------------
+// --------------------------------------------------------------------
+
+
+/* Builtins are interned first by sym_init so their ids are fixed */
+enum { SYM_ADD, SYM_SUB, SYM_MUL, SYM_DIV };
+
+typedef struct {
+  int count;
+  /* Names indexed by symbol id */
+  char** names;
+  /* Open addressed hash of symbol id + 1, zero marks an empty slot */
+  int slots;
+  int* index;
+} lsym_table;
+
+static lsym_table symtab;
+
+static unsigned long sym_hash(char* s) {
+  unsigned long h = 2166136261UL;
+  while (*s) { h = (h ^ (unsigned char)*s++) * 16777619UL; }
+  return h;
+}
+
+static int* sym_slot(char* s) {
+  unsigned long i = sym_hash(s) & (symtab.slots - 1);
+  while (symtab.index[i] != 0
+    && strcmp(symtab.names[symtab.index[i] - 1], s) != 0) {
+    i = (i + 1) & (symtab.slots - 1);
+  }
+  return &symtab.index[i];
+}
+
+/* Return the id of a symbol, adding it to the table the first time */
+int sym_intern(char* s) {
+
+  /* Keep the table at most half full, rehashing into double the slots */
+  if ((symtab.count + 1) * 2 > symtab.slots) {
+    symtab.slots = symtab.slots ? symtab.slots * 2 : 64;
+    free(symtab.index);
+    symtab.index = calloc(symtab.slots, sizeof(int));
+    for (int i = 0; i < symtab.count; i++) {
+      *sym_slot(symtab.names[i]) = i + 1;
+    }
+    symtab.names = realloc(symtab.names, sizeof(char*) * symtab.slots / 2);
+  }
+
+  int* slot = sym_slot(s);
+  if (*slot) { return *slot - 1; }
+
+  symtab.names[symtab.count] = malloc(strlen(s) + 1);
+  strcpy(symtab.names[symtab.count], s);
+  *slot = ++symtab.count;
+  return *slot - 1;
+}
+
+char* sym_name(int id) { return symtab.names[id]; }
+
+void sym_init(void) {
+  sym_intern("+");
+  sym_intern("-");
+  sym_intern("*");
+  sym_intern("/");
+}
+
+
+// -------------------------------------------------------------------
+// ------------------------  MEMORY POOL ------------------------------------
+// --------------------------------------------------------------------
+
+
+/* lvals are carved out of fixed size slabs instead of one malloc each */
+enum { LVAL_SLAB_SIZE = 1024 };
+
+typedef struct lval_slab {
+  struct lval_slab* next;
+  lval nodes[LVAL_SLAB_SIZE];
+} lval_slab;
+
+typedef struct {
+  int id;
+  lval_slab* slabs;
+  lval* free;
+  long slabs_num;
+  /* Stats on nodes currently handed out, and the most ever at once. Only
+     the owner writes these, but stores are atomic so the stats can be read
+     while other threads run. */
+  long live;
+  long peak;
+  /* Nodes freed by other threads, pushed here for the owner to take back */
+  lval* remote;
+  long remote_num;
+} lval_pool;
+
+/* Each thread has its own pool so allocation never takes a lock. A node
+   freed on another thread goes back to the pool it came from. */
+static __thread lval_pool pool;
+
+/* Every thread's pool by index, set up when running in parallel */
+static lval_pool** lval_pools;
+static int lval_pools_num;
+
+void lval_pools_init(int n) {
+  lval_pools = calloc(n, sizeof(lval_pool*));
+  lval_pools_num = n;
+}
+
+/* Called by each thread with its index before it allocates anything */
+void lval_pool_register(int id) {
+  pool.id = id;
+  __atomic_store_n(&lval_pools[id], &pool, __ATOMIC_RELEASE);
+}
+
+/* Thread every node of a slab onto the front of the free list */
+static void lval_pool_thread(lval_slab* s) {
+  for (int i = LVAL_SLAB_SIZE - 1; i >= 0; i--) {
+    s->nodes[i].owner = pool.id;
+    s->nodes[i].next_free = pool.free;
+    pool.free = &s->nodes[i];
+  }
+}
+
+/* Move the nodes other threads have handed back onto our free list */
+static void lval_pool_drain(void) {
+  if (__atomic_load_n(&pool.remote, __ATOMIC_RELAXED) == NULL) { return; }
+  lval* n = __atomic_exchange_n(&pool.remote, NULL, __ATOMIC_ACQUIRE);
+  long taken = __atomic_exchange_n(&pool.remote_num, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&pool.live, pool.live - taken, __ATOMIC_RELAXED);
+  while (n) {
+    lval* next = n->next_free;
+    n->next_free = pool.free;
+    pool.free = n;
+    n = next;
+  }
+}
+
+lval* lval_alloc(void) {
+
+  /* Out of free nodes so take back remote ones, or grab another slab */
+  if (pool.free == NULL) { lval_pool_drain(); }
+  if (pool.free == NULL) {
+    lval_slab* s = malloc(sizeof(lval_slab));
+    s->next = pool.slabs;
+    pool.slabs = s;
+    __atomic_store_n(&pool.slabs_num, pool.slabs_num + 1, __ATOMIC_RELAXED);
+    lval_pool_thread(s);
+  }
+
+  lval* n = pool.free;
+  pool.free = n->next_free;
+
+  __atomic_store_n(&pool.live, pool.live + 1, __ATOMIC_RELAXED);
+  if (pool.live > pool.peak) {
+    __atomic_store_n(&pool.peak, pool.live, __ATOMIC_RELAXED);
+  }
+
+  return n;
+}
+
+void lval_free(lval* v) {
+
+  if (v->owner == pool.id) {
+    v->next_free = pool.free;
+    pool.free = v;
+    __atomic_store_n(&pool.live, pool.live - 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  /* Push onto the owner's remote list, which only the owner ever empties */
+  lval_pool* p = lval_pools[v->owner];
+  v->next_free = __atomic_load_n(&p->remote, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&p->remote, &v->next_free, v,
+    1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+  __atomic_add_fetch(&p->remote_num, 1, __ATOMIC_RELAXED);
+}
+
+/* Once a top level evaluation has released everything, rebuild the
+   free list slab by slab so the next evaluation walks memory in order */
+void lval_pool_reset(void) {
+  lval_pool_drain();
+  if (pool.live != 0) { return; }
+  pool.free = NULL;
+  for (lval_slab* s = pool.slabs; s; s = s->next) {
+    lval_pool_thread(s);
+  }
+}
+
+/* In parallel the figures are summed over every thread's pool, so the
+   peak is an upper bound on the most nodes ever live at once */
+void lval_pool_stats(void) {
+  long live = 0, peak = 0, slabs_num = 0;
+  for (int i = 0; i < (lval_pools ? lval_pools_num : 1); i++) {
+    lval_pool* p = lval_pools ?
+      __atomic_load_n(&lval_pools[i], __ATOMIC_ACQUIRE) : &pool;
+    if (p == NULL) { continue; }
+    live += __atomic_load_n(&p->live, __ATOMIC_RELAXED)
+      - __atomic_load_n(&p->remote_num, __ATOMIC_RELAXED);
+    peak += __atomic_load_n(&p->peak, __ATOMIC_RELAXED);
+    slabs_num += __atomic_load_n(&p->slabs_num, __ATOMIC_RELAXED);
+  }
+  printf("pool: %li live, %li peak nodes (%li bytes), %li slabs (%li bytes)\n",
+    live, peak, peak * (long)sizeof(lval),
+    slabs_num, slabs_num * (long)sizeof(lval_slab));
+}
+
 
 // -------------------------------------------------------------------
 // ------------------------  Constructors/Destructors ------------------------------------
 // --------------------------------------------------------------------
 
 
-/* Construct a pointer to a new Number lval */
+/* Construct a Number lval, boxing it only when it won't fit a tag */
 lval* lval_num(long x) {
-  lval* v = malloc(sizeof(lval));
+  if (x >= LVAL_FIX_MIN && x <= LVAL_FIX_MAX) {
+    return (lval*)(((uintptr_t)x << 1) | 1);
+  }
+  lval* v = lval_alloc();
   v->type = LVAL_NUM;
   v->num = x;
   return v;
@@ -58,40 +316,40 @@ lval* lval_num(long x) {
 
 /* Construct a pointer to a new Error lval */
 lval* lval_err(char* m) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_ERR;
   v->err = malloc(strlen(m) + 1);
   strcpy(v->err, m);
   return v;
 }
 
-/* Construct a pointer to a new Symbol lval */
+/* Construct a Symbol lval, always tagged with its interned id */
 lval* lval_sym(char* s) {
-  lval* v = malloc(sizeof(lval));
-  v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);
-  strcpy(v->sym, s);
-  return v;
+  return (lval*)(((uintptr_t)sym_intern(s) << 2) | 2);
 }
 
 /* A pointer to a new empty Sexpr lval */
 lval* lval_sexpr(void) {
-  lval* v = malloc(sizeof(lval));
+  lval* v = lval_alloc();
   v->type = LVAL_SEXPR;
   v->count = 0;
+  v->cap = 0;
   v->cell = NULL;
   return v;
 }
 
 void lval_del(lval* v) {
 
+  /* Tagged numbers and symbols own no memory */
+  if (!lval_is_heap(v)) { return; }
+
   switch (v->type) {
-    /* Do nothing special for number type */
+    /* Do nothing special for boxed number type */
     case LVAL_NUM: break;
 
-    /* For Err or Sym free the string data */
+    /* For Err free the string data, for Big the limbs */
     case LVAL_ERR: free(v->err); break;
-    case LVAL_SYM: free(v->sym); break;
+    case LVAL_BIG: free(v->limbs); break;
 
     /* If Sexpr then delete all elements inside */
     case LVAL_SEXPR:
@@ -103,8 +361,260 @@ void lval_del(lval* v) {
     break;
   }
 
-  /* Free the memory allocated for the "lval" struct itself */
-  free(v);
+  /* Hand the "lval" struct itself back to the pool */
+  lval_free(v);
+}
+
+
+// -------------------------------------------------------------------
+// ------------------------  BIGNUM ------------------------------------
+// --------------------------------------------------------------------
+
+
+/* A signed magnitude being worked on, limbs least significant first.
+   Magnitudes are kept normalised with no leading zero limbs. */
+typedef struct {
+  int neg;
+  int len;
+  uint32_t* d;
+} lbig;
+
+static lbig big_alloc(int len) {
+  lbig a;
+  a.neg = 0;
+  a.len = len;
+  a.d = calloc(len > 0 ? len : 1, sizeof(uint32_t));
+  return a;
+}
+
+static lbig big_trim(lbig a) {
+  while (a.len > 0 && a.d[a.len-1] == 0) { a.len--; }
+  if (a.len == 0) { a.neg = 0; }
+  return a;
+}
+
+static lbig big_from_long(long x) {
+  lbig a = big_alloc(2);
+  unsigned long m = x < 0 ? 0UL - (unsigned long)x : (unsigned long)x;
+  a.neg = x < 0;
+  a.d[0] = (uint32_t)m;
+  a.d[1] = (uint32_t)(m >> 32);
+  return big_trim(a);
+}
+
+/* Copy out the value of a Number or Big lval */
+static lbig big_from_lval(lval* v) {
+  if (lval_type(v) == LVAL_NUM) { return big_from_long(lval_to_num(v)); }
+  lbig a = big_alloc(abs(v->count));
+  a.neg = v->count < 0;
+  memcpy(a.d, v->limbs, sizeof(uint32_t) * a.len);
+  return a;
+}
+
+/* Hand a result back as a Number when it fits in a long, else as a Big */
+static lval* big_to_lval(lbig a) {
+
+  a = big_trim(a);
+
+  if (a.len <= 2) {
+    unsigned long m = a.len == 0 ? 0 :
+      a.d[0] | (a.len == 2 ? (unsigned long)a.d[1] << 32 : 0);
+    if (m <= (unsigned long)LONG_MAX) {
+      free(a.d);
+      return lval_num(a.neg ? -(long)m : (long)m);
+    }
+    if (a.neg && m == (unsigned long)LONG_MAX + 1) {
+      free(a.d);
+      return lval_num(LONG_MIN);
+    }
+  }
+
+  lval* v = lval_alloc();
+  v->type = LVAL_BIG;
+  v->count = a.neg ? -a.len : a.len;
+  v->limbs = a.d;
+  return v;
+}
+
+static int big_cmp_mag(lbig a, lbig b) {
+  if (a.len != b.len) { return a.len < b.len ? -1 : 1; }
+  for (int i = a.len - 1; i >= 0; i--) {
+    if (a.d[i] != b.d[i]) { return a.d[i] < b.d[i] ? -1 : 1; }
+  }
+  return 0;
+}
+
+/* |a| + |b| */
+static lbig big_add_mag(lbig a, lbig b) {
+  if (a.len < b.len) { lbig t = a; a = b; b = t; }
+  lbig r = big_alloc(a.len + 1);
+  uint64_t carry = 0;
+  for (int i = 0; i < a.len; i++) {
+    carry += (uint64_t)a.d[i] + (i < b.len ? b.d[i] : 0);
+    r.d[i] = (uint32_t)carry;
+    carry >>= 32;
+  }
+  r.d[a.len] = (uint32_t)carry;
+  return big_trim(r);
+}
+
+/* |a| - |b|, where |a| >= |b| */
+static lbig big_sub_mag(lbig a, lbig b) {
+  lbig r = big_alloc(a.len);
+  int64_t borrow = 0;
+  for (int i = 0; i < a.len; i++) {
+    int64_t t = (int64_t)a.d[i] - (i < b.len ? b.d[i] : 0) - borrow;
+    borrow = t < 0;
+    r.d[i] = (uint32_t)t;
+  }
+  return big_trim(r);
+}
+
+static lbig big_add(lbig a, lbig b) {
+  lbig r;
+  if (a.neg == b.neg) {
+    r = big_add_mag(a, b);
+    r.neg = a.neg;
+  } else if (big_cmp_mag(a, b) >= 0) {
+    r = big_sub_mag(a, b);
+    r.neg = a.neg;
+  } else {
+    r = big_sub_mag(b, a);
+    r.neg = b.neg;
+  }
+  return big_trim(r);
+}
+
+static lbig big_sub(lbig a, lbig b) {
+  b.neg = !b.neg;
+  return big_add(a, b);
+}
+
+/* Schoolbook multiply, one 64 bit multiply-accumulate per limb pair */
+static lbig big_mul(lbig a, lbig b) {
+  lbig r = big_alloc(a.len + b.len);
+  for (int i = 0; i < a.len; i++) {
+    uint64_t carry = 0;
+    for (int j = 0; j < b.len; j++) {
+      carry += (uint64_t)a.d[i] * b.d[j] + r.d[i+j];
+      r.d[i+j] = (uint32_t)carry;
+      carry >>= 32;
+    }
+    r.d[i + b.len] = (uint32_t)carry;
+  }
+  r.neg = a.neg != b.neg;
+  return big_trim(r);
+}
+
+/* Divide a magnitude by a single limb in place, returning the remainder */
+static uint32_t big_div_limb(uint32_t* d, int len, uint32_t v) {
+  uint64_t rem = 0;
+  for (int i = len - 1; i >= 0; i--) {
+    uint64_t cur = (rem << 32) | d[i];
+    d[i] = (uint32_t)(cur / v);
+    rem = cur % v;
+  }
+  return (uint32_t)rem;
+}
+
+/* Knuth's Algorithm D. q gets u / v where u has m limbs and v has n,
+   with m >= n >= 2 and the top limb of v non-zero. */
+static void big_div_knuth(uint32_t* q, uint32_t* u, int m, uint32_t* v, int n) {
+
+  /* Normalise so the top limb of v has its high bit set */
+  int s = __builtin_clz(v[n-1]);
+  uint32_t* vn = malloc(sizeof(uint32_t) * n);
+  uint32_t* un = malloc(sizeof(uint32_t) * (m + 1));
+
+  for (int i = n - 1; i > 0; i--) {
+    vn[i] = (v[i] << s) | (s ? v[i-1] >> (32 - s) : 0);
+  }
+  vn[0] = v[0] << s;
+
+  un[m] = s ? u[m-1] >> (32 - s) : 0;
+  for (int i = m - 1; i > 0; i--) {
+    un[i] = (u[i] << s) | (s ? u[i-1] >> (32 - s) : 0);
+  }
+  un[0] = u[0] << s;
+
+  for (int j = m - n; j >= 0; j--) {
+
+    /* Estimate the quotient limb from the top two limbs, then correct it */
+    uint64_t num = ((uint64_t)un[j+n] << 32) | un[j+n-1];
+    uint64_t qhat = num / vn[n-1];
+    uint64_t rhat = num % vn[n-1];
+    while (qhat >> 32
+      || qhat * vn[n-2] > ((rhat << 32) | un[j+n-2])) {
+      qhat--;
+      rhat += vn[n-1];
+      if (rhat >> 32) { break; }
+    }
+
+    /* Multiply and subtract */
+    int64_t k = 0, t;
+    for (int i = 0; i < n; i++) {
+      uint64_t p = qhat * vn[i];
+      t = (int64_t)un[i+j] - k - (int64_t)(p & 0xFFFFFFFF);
+      un[i+j] = (uint32_t)t;
+      k = (int64_t)(p >> 32) - (t >> 32);
+    }
+    t = (int64_t)un[j+n] - k;
+    un[j+n] = (uint32_t)t;
+
+    /* Estimate was one too large, add back */
+    q[j] = (uint32_t)qhat;
+    if (t < 0) {
+      q[j]--;
+      k = 0;
+      for (int i = 0; i < n; i++) {
+        t = (int64_t)un[i+j] + vn[i] + k;
+        un[i+j] = (uint32_t)t;
+        k = t >> 32;
+      }
+      un[j+n] += (uint32_t)k;
+    }
+  }
+
+  free(vn);
+  free(un);
+}
+
+/* Quotient truncated towards zero, as with long division in C */
+static lbig big_div(lbig a, lbig b) {
+
+  /* Callers rule out a zero divisor, and |a| >= |b| leaves a with limbs */
+  if (b.len < 1 || big_cmp_mag(a, b) < 0) { return big_alloc(0); }
+
+  lbig q = big_alloc(a.len);
+  if (b.len == 1) {
+    memcpy(q.d, a.d, sizeof(uint32_t) * a.len);
+    big_div_limb(q.d, q.len, b.d[0]);
+  } else {
+    big_div_knuth(q.d, a.d, a.len, b.d, b.len);
+  }
+  q.neg = a.neg != b.neg;
+  return big_trim(q);
+}
+
+/* Decimal digits come from peeling off base 10^9 chunks */
+static void big_print(lval* v) {
+
+  lbig a = big_from_lval(v);
+  uint32_t* chunks = malloc(sizeof(uint32_t) * (a.len * 10 / 9 + 2));
+  int n = 0;
+
+  /* A Big is never zero, but there is always at least one chunk */
+  do {
+    chunks[n++] = big_div_limb(a.d, a.len, 1000000000);
+    a = big_trim(a);
+  } while (a.len > 0);
+
+  if (v->count < 0) { putchar('-'); }
+  printf("%u", chunks[n-1]);
+  for (int i = n - 2; i >= 0; i--) { printf("%09u", chunks[i]); }
+
+  free(chunks);
+  free(a.d);
 }
 
 
@@ -114,9 +624,12 @@ void lval_del(lval* v) {
 
 
 lval* lval_add(lval* v, lval* x) {
-  v->count++;
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-  v->cell[v->count-1] = x;
+  /* Double the capacity when full so appends are amortized O(1) */
+  if (v->count == v->cap) {
+    v->cap = v->cap ? v->cap * 2 : 4;
+    v->cell = realloc(v->cell, sizeof(lval*) * v->cap);
+  }
+  v->cell[v->count++] = x;
   return v;
 }
 
@@ -128,20 +641,39 @@ lval* lval_pop(lval* v, int i) {
   memmove(&v->cell[i], &v->cell[i+1],
     sizeof(lval*) * (v->count-i-1));
 
-  /* Decrease the count of items in the list */
+  /* Decrease the count of items in the list, keeping the capacity */
   v->count--;
-
-  /* Reallocate the memory used */
-  v->cell = realloc(v->cell, sizeof(lval*) * v->count);
   return x;
 }
 
 lval* lval_take(lval* v, int i) {
-  lval* x = lval_pop(v, i);
+  /* Unlink the item in place rather than shifting the rest down */
+  lval* x = v->cell[i];
+  v->cell[i] = v->cell[--v->count];
   lval_del(v);
   return x;
 }
 
+lval* lval_copy(lval* v) {
+
+  /* Tagged values are copied by value */
+  if (!lval_is_heap(v)) { return v; }
+
+  lval* x = NULL;
+  switch (v->type) {
+    case LVAL_NUM: x = lval_num(v->num); break;
+    case LVAL_ERR: x = lval_err(v->err); break;
+    case LVAL_BIG: x = big_to_lval(big_from_lval(v)); break;
+    case LVAL_SEXPR:
+      x = lval_sexpr();
+      for (int i = 0; i < v->count; i++) {
+        lval_add(x, lval_copy(v->cell[i]));
+      }
+    break;
+  }
+  return x;
+}
+
 void lval_print(lval* v);
 
 void lval_expr_print(lval* v, char open, char close) {
@@ -166,10 +698,11 @@ void lval_expr_print(lval* v, char open, char close) {
 
 
 void lval_print(lval* v) {
-  switch (v->type) {
-    case LVAL_NUM:   printf("%li", v->num); break;
+  switch (lval_type(v)) {
+    case LVAL_NUM:   printf("%li", lval_to_num(v)); break;
+    case LVAL_BIG:   big_print(v); break;
     case LVAL_ERR:   printf("Error: %s", v->err); break;
-    case LVAL_SYM:   printf("%s", v->sym); break;
+    case LVAL_SYM:   printf("%s", sym_name(lval_to_sym(v))); break;
     case LVAL_SEXPR: lval_expr_print(v, '(', ')'); break;
   }
 }
@@ -183,47 +716,198 @@ void lval_println(lval* v) { lval_print(v); putchar('\n'); }
 
 
 
-lval* builtin_op(lval* a, char* op) {
+/* Wrapping arithmetic, done unsigned so the vector lanes are well defined */
+#define LVAL_WRAP_ADD(x, y) ((long)((unsigned long)(x) + (unsigned long)(y)))
+#define LVAL_WRAP_SUB(x, y) ((long)((unsigned long)(x) - (unsigned long)(y)))
 
-  /* Ensure all arguments are numbers */
-  for (int i = 0; i < a->count; i++) {
-    if (a->cell[i]->type != LVAL_NUM) {
-      lval_del(a);
-      return lval_err("Cannot operate on non-number!");
+/* Sum of "n" longs, wrapping on overflow */
+static long lval_sum_scalar(long* xs, int n) {
+  unsigned long x = 0;
+  for (int i = 0; i < n; i++) { x += (unsigned long)xs[i]; }
+  return (long)x;
+}
+
+#ifdef LVAL_SIMD_X86
+
+/* Two lanes per register, with two accumulators to hide add latency */
+static long lval_sum_sse2(long* xs, int n) {
+  __m128i a = _mm_setzero_si128();
+  __m128i b = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    a = _mm_add_epi64(a, _mm_loadu_si128((__m128i*)(xs + i)));
+    b = _mm_add_epi64(b, _mm_loadu_si128((__m128i*)(xs + i + 2)));
+  }
+  long lanes[2];
+  _mm_storeu_si128((__m128i*)lanes, _mm_add_epi64(a, b));
+  return LVAL_WRAP_ADD(LVAL_WRAP_ADD(lanes[0], lanes[1]),
+    lval_sum_scalar(xs + i, n - i));
+}
+
+__attribute__((target("avx2")))
+static long lval_sum_avx2(long* xs, int n) {
+  __m256i a = _mm256_setzero_si256();
+  __m256i b = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    a = _mm256_add_epi64(a, _mm256_loadu_si256((__m256i*)(xs + i)));
+    b = _mm256_add_epi64(b, _mm256_loadu_si256((__m256i*)(xs + i + 4)));
+  }
+  long lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, _mm256_add_epi64(a, b));
+  long x = LVAL_WRAP_ADD(LVAL_WRAP_ADD(lanes[0], lanes[1]),
+    LVAL_WRAP_ADD(lanes[2], lanes[3]));
+  return LVAL_WRAP_ADD(x, lval_sum_scalar(xs + i, n - i));
+}
+
+#endif
+
+/* Picked once at startup for the CPU we are running on */
+static long (*lval_sum)(long*, int) = lval_sum_scalar;
+
+void lval_sum_init(void) {
+#ifdef LVAL_SIMD_X86
+  __builtin_cpu_init();
+  lval_sum = __builtin_cpu_supports("avx2") ? lval_sum_avx2 : lval_sum_sse2;
+#endif
+}
+
+/* Carry on a reduction in bignum arithmetic from argument "i" onwards,
+   once the running result no longer fits in a long */
+static lval* lval_reduce_big(lbig x, lval** args, int i, int n, int op) {
+
+  /* If no arguments and sub then perform unary negation */
+  if (op == SYM_SUB && n == 1) { x.neg = !x.neg; }
+
+  for (; i < n; i++) {
+    lbig y = big_from_lval(args[i]);
+    lbig r;
+
+    if (op == SYM_DIV && y.len == 0) {
+      free(x.d); free(y.d);
+      return lval_err("Division By Zero.");
+    }
+
+    switch (op) {
+      case SYM_ADD: r = big_add(x, y); break;
+      case SYM_SUB: r = big_sub(x, y); break;
+      case SYM_MUL: r = big_mul(x, y); break;
+      case SYM_DIV: r = big_div(x, y); break;
+      default: r = big_alloc(0); break;
     }
+
+    free(x.d); free(y.d);
+    x = r;
   }
 
-  /* Pop the first element */
-  lval* x = lval_pop(a, 0);
+  return big_to_lval(x);
+}
+
+/* With --checked an overflowing operation is an error instead of
+   carrying on as a Big */
+static int lval_checked = 0;
+
+/* A step starting from "x" at argument "i" overflowed a long */
+static lval* lval_overflow(long x, lval** args, int i, int n, int op) {
+  if (lval_checked) { return lval_err("Integer Overflow."); }
+  return lval_reduce_big(big_from_long(x), args, i, n, op);
+}
+
+/* Reduce "n" numbers left to right in longs, with "xs" holding the values
+   of "args". Overflow is checked and hands over to lval_overflow.
+   "mag" is the largest magnitude among them, which bounds every partial
+   sum by n * mag. */
+static lval* lval_reduce(lval** args, long* xs, int n, int op, unsigned long mag) {
+
+  long x = xs[0];
 
   /* If no arguments and sub then perform unary negation */
-  if ((strcmp(op, "-") == 0) && a->count == 0) {
-    x->num = -x->num;
+  if (op == SYM_SUB && n == 1) {
+    if (x == LONG_MIN) { return lval_overflow(x, args, 1, n, op); }
+    return lval_num(-x);
   }
 
-  /* While there are still elements remaining */
-  while (a->count > 0) {
+  for (int i = 1; i < n; i++) {
+    long r;
+
+    switch (op) {
+
+      case SYM_ADD:
+      case SYM_SUB:
+        /* When the bound shows no partial sum can overflow the order
+           doesn't matter, so sum the lot with the vector kernel */
+        if (i == 1 && mag <= (unsigned long)LONG_MAX / n) {
+          long y = lval_sum(xs + 1, n - 1);
+          return lval_num(op == SYM_ADD ? LVAL_WRAP_ADD(x, y) : LVAL_WRAP_SUB(x, y));
+        }
+        if (op == SYM_ADD
+          ? __builtin_add_overflow(x, xs[i], &r)
+          : __builtin_sub_overflow(x, xs[i], &r)) {
+          return lval_overflow(x, args, i, n, op);
+        }
+      break;
+
+      case SYM_MUL:
+        if (__builtin_mul_overflow(x, xs[i], &r)) {
+          return lval_overflow(x, args, i, n, op);
+        }
+      break;
+
+      case SYM_DIV:
+        if (xs[i] == 0) { return lval_err("Division By Zero."); }
+        /* The one quotient that doesn't fit */
+        if (x == LONG_MIN && xs[i] == -1) {
+          return lval_overflow(x, args, i, n, op);
+        }
+        r = x / xs[i];
+      break;
+
+      default: r = x; break;
+    }
 
-    /* Pop the next element */
-    lval* y = lval_pop(a, 0);
+    x = r;
+  }
 
-    /* Perform operation */
-    if (strcmp(op, "+") == 0) { x->num += y->num; }
-    if (strcmp(op, "-") == 0) { x->num -= y->num; }
-    if (strcmp(op, "*") == 0) { x->num *= y->num; }
-    if (strcmp(op, "/") == 0) {
-      if (y->num == 0) {
-        lval_del(x); lval_del(y);
-        x = lval_err("Division By Zero.");
-        break;
-      }
-      x->num /= y->num;
+  return lval_num(x);
+}
+
+enum { LVAL_GATHER_MIN = 64 };
+
+/* Apply a builtin to "n" arguments, which stay owned by the caller */
+lval* builtin_apply(lval** args, int n, int op) {
+
+  /* Ensure all arguments are numbers, noting if any are already Big */
+  int big = 0;
+  for (int i = 0; i < n; i++) {
+    int t = lval_type(args[i]);
+    if (t != LVAL_NUM && t != LVAL_BIG) {
+      return lval_err("Cannot operate on non-number!");
     }
+    if (t == LVAL_BIG) { big = 1; }
+  }
+
+  /* Both reductions start from the first argument, so there must be one */
+  if (n < 1) { return lval_err("Function passed no arguments!"); }
 
-    /* Delete element now finished with */
-    lval_del(y);
+  if (big) { return lval_reduce_big(big_from_lval(args[0]), args, 1, n, op); }
+
+  /* Gather the arguments into a contiguous buffer of longs */
+  long buf[LVAL_GATHER_MIN];
+  long* xs = n > LVAL_GATHER_MIN ? malloc(sizeof(long) * n) : buf;
+  unsigned long mag = 0;
+  for (int i = 0; i < n; i++) {
+    xs[i] = lval_to_num(args[i]);
+    unsigned long m = xs[i] < 0 ? 0UL - (unsigned long)xs[i] : (unsigned long)xs[i];
+    if (m > mag) { mag = m; }
   }
 
+  lval* x = lval_reduce(args, xs, n, op, mag);
+  if (xs != buf) { free(xs); }
+  return x;
+}
+
+lval* builtin_op(lval* a, int op) {
+  lval* x = builtin_apply(a->cell, a->count, op);
   /* Delete input expression and return result */
   lval_del(a);
   return x;
@@ -231,6 +915,8 @@ lval* builtin_op(lval* a, char* op) {
 
 lval* lval_eval(lval* v);
 
+lval* lval_eval_sexpr_reduce(lval* v);
+
 lval* lval_eval_sexpr(lval* v) {
 
   /* Evaluate Children */
@@ -238,9 +924,15 @@ lval* lval_eval_sexpr(lval* v) {
     v->cell[i] = lval_eval(v->cell[i]);
   }
 
+  return lval_eval_sexpr_reduce(v);
+}
+
+/* Reduce a Sexpr whose children have all been evaluated */
+lval* lval_eval_sexpr_reduce(lval* v) {
+
   /* Error Checking */
   for (int i = 0; i < v->count; i++) {
-    if (v->cell[i]->type == LVAL_ERR) { return lval_take(v, i); }
+    if (lval_type(v->cell[i]) == LVAL_ERR) { return lval_take(v, i); }
   }
 
   /* Empty Expression */
@@ -251,24 +943,223 @@ lval* lval_eval_sexpr(lval* v) {
 
   /* Ensure First Element is Symbol */
   lval* f = lval_pop(v, 0);
-  if (f->type != LVAL_SYM) {
+  if (lval_type(f) != LVAL_SYM) {
     lval_del(f); lval_del(v);
     return lval_err("S-expression Does not start with symbol.");
   }
 
   /* Call builtin with operator */
-  lval* result = builtin_op(v, f->sym);
+  lval* result = builtin_op(v, lval_to_sym(f));
   lval_del(f);
   return result;
 }
 
 lval* lval_eval(lval* v) {
   /* Evaluate Sexpressions */
-  if (v->type == LVAL_SEXPR) { return lval_eval_sexpr(v); }
+  if (lval_type(v) == LVAL_SEXPR) { return lval_eval_sexpr(v); }
   /* All other lval types remain the same */
   return v;
 }
 
+// -------------------------------------------------------------------
+// ------------------------  PARALLEL EVAL ------------------------------------
+// --------------------------------------------------------------------
+
+
+/*
+ * With --threads N the children of large Sexprs are evaluated on a pool
+ * of N threads. Every thread owns a deque of tasks: it pushes and pops
+ * its own work at the bottom, and when it runs dry it steals from the
+ * top of another thread's deque. A thread waiting on its children keeps
+ * running tasks rather than blocking, so nested forks can't deadlock.
+ *
+ * Builtins have no side effects, so evaluating siblings in any order
+ * gives the same values. Errors are still picked by the in-order scan
+ * in lval_eval_sexpr_reduce, so the first error still wins.
+ */
+enum { LPAR_DEQUE_SIZE = 4096, LPAR_MIN_NODES = 256 };
+
+typedef struct {
+  /* Child to evaluate in place, and the parent's count of unfinished children */
+  lval** slot;
+  int* pending;
+} ltask;
+
+typedef struct {
+  pthread_mutex_t lock;
+  long top;
+  long bottom;
+  ltask tasks[LPAR_DEQUE_SIZE];
+} ldeque;
+
+/* Number of threads including the main one, zero when running serially */
+static int lpar_threads = 0;
+static ldeque* lpar_deques;
+static __thread int lpar_self = 0;
+
+/* Idle threads sleep until some task is queued anywhere */
+static int lpar_queued = 0;
+static pthread_mutex_t lpar_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lpar_idle_cond = PTHREAD_COND_INITIALIZER;
+
+static int ldeque_push(ldeque* d, ltask t) {
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom - d->top == LPAR_DEQUE_SIZE) {
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+  }
+  d->tasks[d->bottom++ % LPAR_DEQUE_SIZE] = t;
+  pthread_mutex_unlock(&d->lock);
+
+  __atomic_add_fetch(&lpar_queued, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_lock(&lpar_idle_lock);
+  pthread_cond_signal(&lpar_idle_cond);
+  pthread_mutex_unlock(&lpar_idle_lock);
+  return 1;
+}
+
+/* Owner takes the newest task, thieves take the oldest */
+static int ldeque_take(ldeque* d, ltask* t, int steal) {
+  pthread_mutex_lock(&d->lock);
+  if (d->bottom == d->top) {
+    pthread_mutex_unlock(&d->lock);
+    return 0;
+  }
+  *t = steal
+    ? d->tasks[d->top++ % LPAR_DEQUE_SIZE]
+    : d->tasks[--d->bottom % LPAR_DEQUE_SIZE];
+  pthread_mutex_unlock(&d->lock);
+  __atomic_sub_fetch(&lpar_queued, 1, __ATOMIC_SEQ_CST);
+  return 1;
+}
+
+static int lpar_find(ltask* t) {
+  if (ldeque_take(&lpar_deques[lpar_self], t, 0)) { return 1; }
+  for (int k = 1; k < lpar_threads; k++) {
+    if (ldeque_take(&lpar_deques[(lpar_self + k) % lpar_threads], t, 1)) { return 1; }
+  }
+  return 0;
+}
+
+lval* lval_eval_par(lval* v);
+
+static void lpar_run(ltask t) {
+  *t.slot = lval_eval_par(*t.slot);
+  __atomic_sub_fetch(t.pending, 1, __ATOMIC_ACQ_REL);
+}
+
+static void* lpar_worker(void* arg) {
+  lpar_self = (int)(intptr_t)arg;
+  lval_pool_register(lpar_self);
+  while (1) {
+    ltask t;
+    if (lpar_find(&t)) { lpar_run(t); continue; }
+    pthread_mutex_lock(&lpar_idle_lock);
+    while (__atomic_load_n(&lpar_queued, __ATOMIC_SEQ_CST) == 0) {
+      pthread_cond_wait(&lpar_idle_cond, &lpar_idle_lock);
+    }
+    pthread_mutex_unlock(&lpar_idle_lock);
+  }
+  return NULL;
+}
+
+/* Start "n" - 1 workers, the calling thread being the n-th */
+void lpar_init(int n) {
+  lpar_threads = n;
+  lval_pools_init(n);
+  lval_pool_register(0);
+  lpar_deques = calloc(n, sizeof(ldeque));
+  for (int i = 0; i < n; i++) {
+    pthread_mutex_init(&lpar_deques[i].lock, NULL);
+  }
+  for (int i = 1; i < n; i++) {
+    pthread_t th;
+    pthread_create(&th, NULL, lpar_worker, (void*)(intptr_t)i);
+    pthread_detach(th);
+  }
+}
+
+/* Count the nodes of "v", giving up once "limit" is reached */
+static int lval_nodes(lval* v, int limit) {
+  if (lval_type(v) != LVAL_SEXPR) { return 1; }
+  int n = 1;
+  for (int i = 0; i < v->count && n < limit; i++) {
+    n += lval_nodes(v->cell[i], limit - n);
+  }
+  return n;
+}
+
+lval* lval_eval_par(lval* v) {
+
+  if (lval_type(v) != LVAL_SEXPR) { return v; }
+
+  /* Small trees aren't worth the hand off */
+  if (lpar_threads < 2 || lval_nodes(v, LPAR_MIN_NODES) < LPAR_MIN_NODES) {
+    return lval_eval(v);
+  }
+
+  /* Offer every large child but the first to the pool */
+  int pending = 0;
+  char* pushed = calloc(v->count, 1);
+  for (int i = 1; i < v->count; i++) {
+    if (lval_nodes(v->cell[i], LPAR_MIN_NODES) < LPAR_MIN_NODES) { continue; }
+    /* Thieves may already be finishing earlier children, so the count
+       is only ever changed atomically */
+    __atomic_add_fetch(&pending, 1, __ATOMIC_ACQ_REL);
+    ltask t = { &v->cell[i], &pending };
+    if (ldeque_push(&lpar_deques[lpar_self], t)) {
+      pushed[i] = 1;
+    } else {
+      __atomic_sub_fetch(&pending, 1, __ATOMIC_ACQ_REL);
+    }
+  }
+
+  /* Evaluate the rest here while the others are picked up */
+  for (int i = 0; i < v->count; i++) {
+    if (!pushed[i]) { v->cell[i] = lval_eval_par(v->cell[i]); }
+  }
+
+  /* Help out until all of our children are done */
+  while (__atomic_load_n(&pending, __ATOMIC_ACQUIRE) > 0) {
+    ltask t;
+    if (lpar_find(&t)) { lpar_run(t); } else { sched_yield(); }
+  }
+
+  free(pushed);
+  return lval_eval_sexpr_reduce(v);
+}
+
+
+// -------------------------------------------------------------------
+// ------------------------  FOLDING ------------------------------------
+// --------------------------------------------------------------------
+
+
+/* Collapse every builtin call whose arguments are all numbers into its
+   result, ahead of evaluation. A division by zero folds into the same
+   error builtin_op would give, which the evaluator then reports as it
+   would have anyway. */
+lval* lval_fold(lval* v) {
+
+  if (lval_type(v) != LVAL_SEXPR) { return v; }
+
+  for (int i = 0; i < v->count; i++) {
+    v->cell[i] = lval_fold(v->cell[i]);
+  }
+
+  /* Only a symbol applied to one or more numbers can be folded */
+  if (v->count < 2 || lval_type(v->cell[0]) != LVAL_SYM) { return v; }
+  for (int i = 1; i < v->count; i++) {
+    int t = lval_type(v->cell[i]);
+    if (t != LVAL_NUM && t != LVAL_BIG) { return v; }
+  }
+
+  lval* f = lval_pop(v, 0);
+  lval* x = builtin_op(v, lval_to_sym(f));
+  lval_del(f);
+  return x;
+}
+
 lval* lval_read_num(mpc_ast_t* t) {
   errno = 0;
   long x = strtol(t->contents, NULL, 10);
@@ -276,22 +1167,24 @@ lval* lval_read_num(mpc_ast_t* t) {
     lval_num(x) : lval_err("invalid number");
 }
 
+/* Rule ids mpca_lang gives AST nodes, in the order the rules are passed */
+enum { RULE_NUMBER = 1, RULE_SYMBOL, RULE_SEXPR, RULE_EXPR, RULE_LISPY };
+
 lval* lval_read(mpc_ast_t* t) {
 
   /* If Symbol or Number return conversion to that type */
-  if (strstr(t->tag, "number")) { return lval_read_num(t); }
-  if (strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
+  switch (t->id) {
+    case RULE_NUMBER: return lval_read_num(t);
+    case RULE_SYMBOL: return lval_sym(t->contents);
+  }
 
-  /* If root (>) or sexpr then create empty list */
-  lval* x = NULL;
-  if (strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
-  if (strstr(t->tag, "sexpr"))  { x = lval_sexpr(); }
+  /* Otherwise this is the root or a sexpr, so create an empty list */
+  lval* x = lval_sexpr();
 
-  /* Fill this list with any valid expression contained within */
+  /* Fill this list with any valid expression contained within. Parens
+     and the anchoring regexes belong to no rule, so their id is 0 */
   for (int i = 0; i < t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0) { continue; }
-    if (strcmp(t->children[i]->contents, ")") == 0) { continue; }
-    if (strcmp(t->children[i]->tag,  "regex") == 0) { continue; }
+    if (t->children[i]->id == 0) { continue; }
     x = lval_add(x, lval_read(t->children[i]));
   }
 
@@ -300,18 +1193,783 @@ lval* lval_read(mpc_ast_t* t) {
 
 
 // -------------------------------------------------------------------
-// ------------------------  MAIN  ------------------------------------
+// ------------------------  DIRECT READER ------------------------------------
+// --------------------------------------------------------------------
+
+
+/*
+ * The direct reader builds the lispy grammar from mpc combinators whose
+ * apply and fold callbacks return lvals, so parsing produces the same
+ * tree lval_read would without ever allocating an mpc_ast_t.
+ *
+ * Numbers stay boxed while mpc holds them. mpc_export treats any value
+ * that falls inside its input arena as its own, and a tagged fixnum can
+ * look like such an address. They are tagged once folded into a Sexpr.
+ */
+mpc_val_t* lvalf_num(mpc_val_t* s) {
+  errno = 0;
+  long x = strtol(s, NULL, 10);
+  free(s);
+  if (errno == ERANGE) { return lval_err("invalid number"); }
+  lval* v = lval_alloc();
+  v->type = LVAL_NUM;
+  v->num = x;
+  return v;
+}
+
+mpc_val_t* lvalf_sym(mpc_val_t* s) {
+  lval* v = lval_sym(s);
+  free(s);
+  return v;
+}
+
+/* Swap a number boxed by lvalf_num for its usual representation */
+lval* lval_unbox(lval* v) {
+  if (!lval_is_heap(v) || v->type != LVAL_NUM) { return v; }
+  lval* x = lval_num(v->num);
+  lval_del(v);
+  return x;
+}
+
+mpc_val_t* lvalf_sexpr(int n, mpc_val_t** xs) {
+  lval* x = lval_sexpr();
+  x->cell = malloc(sizeof(lval*) * (n ? n : 1));
+  x->cap = n;
+  for (int i = 0; i < n; i++) {
+    x->cell[i] = lval_unbox(xs[i]);
+  }
+  x->count = n;
+  return x;
+}
+
+void lvalf_del(mpc_val_t* x) { lval_del(x); }
+
+/* Define "expr" and return a parser for a whole line of expressions */
+mpc_parser_t* lval_reader(mpc_parser_t* expr) {
+
+  mpc_parser_t* number = mpc_apply(mpc_tok(mpc_re("-?[0-9]+")), lvalf_num);
+  mpc_parser_t* symbol = mpc_apply(mpc_or(4,
+    mpc_tok(mpc_char('+')), mpc_tok(mpc_char('-')),
+    mpc_tok(mpc_char('*')), mpc_tok(mpc_char('/'))), lvalf_sym);
+  mpc_parser_t* sexpr = mpc_and(3, mpcf_snd_free,
+    mpc_tok(mpc_char('(')), mpc_many(lvalf_sexpr, expr), mpc_tok(mpc_char(')')),
+    free, lvalf_del);
+
+  mpc_define(expr, mpc_or(3, number, symbol, sexpr));
+
+  /* Ended by /$/ as in the grammar, so a failure there expects the same */
+  return mpc_define(mpc_new("line"), mpc_and(3, mpcf_snd_free,
+    mpc_tok(mpc_soi()), mpc_many(lvalf_sexpr, expr), mpc_tok(mpc_re("$")),
+    free, lvalf_del));
+}
+
+
+// -------------------------------------------------------------------
+// ------------------------  HAND READER ------------------------------------
+// --------------------------------------------------------------------
+
+
+/*
+ * A recursive descent reader for the lispy grammar that works in place
+ * on the input string, allocating nothing but the lvals it returns.
+ *
+ * To report errors the way mpc does it records, in order and without
+ * duplicates, everything it expected at the furthest position it failed
+ * at. This follows the order mpc tries the alternatives in, so the final
+ * mpc_err_t prints exactly as the mpca_lang grammar's would.
+ */
+
+#define LRD_EXPECTED_MAX 16
+#define LRD_DEPTH_MAX 4096
+
+typedef struct {
+  char* s;
+  long pos;
+  int depth;
+  long fail;
+  int expected_num;
+  char* expected[LRD_EXPECTED_MAX];
+} lreader;
+
+void lrd_expect(lreader* r, long pos, char* e) {
+  if (pos < r->fail) { return; }
+  if (pos > r->fail) { r->fail = pos; r->expected_num = 0; }
+  for (int i = 0; i < r->expected_num; i++) {
+    if (strcmp(r->expected[i], e) == 0) { return; }
+  }
+  r->expected[r->expected_num++] = e;
+}
+
+void lrd_blank(lreader* r) {
+  while (r->s[r->pos] && strchr(" \f\n\r\t\v", r->s[r->pos])) { r->pos++; }
+}
+
+int lrd_digit(char c) { return c >= '0' && c <= '9'; }
+
+lval* lrd_expr(lreader* r) {
+
+  long p = r->pos;
+  char c = r->s[p];
+
+  /* number : /-?[0-9]+/ */
+  long q = p;
+  if (c == '-') { q++; } else { lrd_expect(r, p, "'-'"); }
+  if (!lrd_digit(r->s[q])) {
+    lrd_expect(r, q, "one or more of one of '0123456789'");
+  } else {
+    while (lrd_digit(r->s[q])) { q++; }
+    lrd_expect(r, q, "one of '0123456789'");
+    errno = 0;
+    long x = strtol(r->s + p, NULL, 10);
+    r->pos = q;
+    lrd_blank(r);
+    return errno != ERANGE ? lval_num(x) : lval_err("invalid number");
+  }
+
+  /* symbol : '+' | '-' | '*' | '/' */
+  static char* symbols[] = { "'+'", "'-'", "'*'", "'/'" };
+  for (int i = 0; i < 4; i++) {
+    if (c == symbols[i][1]) {
+      char name[2] = { c, '\0' };
+      r->pos = p + 1;
+      lrd_blank(r);
+      return lval_sym(name);
+    }
+    lrd_expect(r, p, symbols[i]);
+  }
+
+  /* sexpr : '(' <expr>* ')' */
+  if (c != '(') {
+    lrd_expect(r, p, "'('");
+    return NULL;
+  }
+  if (r->depth == LRD_DEPTH_MAX) { r->depth = -1; return NULL; }
+
+  r->depth++;
+  r->pos = p + 1;
+  lrd_blank(r);
+
+  lval* x = lval_sexpr();
+  lval* y;
+  while ((y = lrd_expr(r))) { x = lval_add(x, y); }
+  if (r->depth < 0) { lval_del(x); return NULL; }
+  r->depth--;
+
+  if (r->s[r->pos] != ')') {
+    lrd_expect(r, r->pos, "')'");
+    lval_del(x);
+    r->pos = p;
+    return NULL;
+  }
+  r->pos++;
+  lrd_blank(r);
+  return x;
+}
+
+/* A blank error for "filename", to be filled in like mpc's own */
+mpc_err_t* lrd_err(char* filename) {
+  mpc_err_t* e = calloc(1, sizeof(mpc_err_t));
+  e->filename = malloc(strlen(filename) + 1);
+  strcpy(e->filename, filename);
+  return e;
+}
+
+mpc_err_t* lrd_failure(char* filename, char* failure) {
+  mpc_err_t* e = lrd_err(filename);
+  e->failure = malloc(strlen(failure) + 1);
+  strcpy(e->failure, failure);
+  e->received = ' ';
+  return e;
+}
+
+/* Parse a whole line like the lispy rule, giving a Sexpr of its exprs */
+int lval_parse(char* filename, char* s, mpc_result_t* r) {
+
+  lreader rd = { s, 0, 0, -1, 0, { NULL } };
+  lrd_blank(&rd);
+
+  lval* x = lval_sexpr();
+  lval* y;
+  while ((y = lrd_expr(&rd))) { x = lval_add(x, y); }
+
+  if (rd.depth < 0) {
+    lval_del(x);
+    r->error = lrd_failure(filename, "Maximum recursion depth exceeded!");
+    return 0;
+  }
+
+  if (s[rd.pos] == '\0') {
+    r->output = x;
+    return 1;
+  }
+  lval_del(x);
+
+  /* /$/ : a newline then the end of input, or just the end of input */
+  lrd_expect(&rd, rd.pos, "newline");
+  lrd_expect(&rd, rd.pos, "end of input");
+
+  mpc_err_t* e = lrd_err(filename);
+  e->state.pos = rd.fail;
+  for (long i = 0; i < rd.fail; i++) {
+    if (s[i] == '\n') { e->state.row++; e->state.col = 0; }
+    else { e->state.col++; }
+  }
+  e->expected_num = rd.expected_num;
+  e->expected = malloc(sizeof(char*) * rd.expected_num);
+  for (int i = 0; i < rd.expected_num; i++) {
+    e->expected[i] = malloc(strlen(rd.expected[i]) + 1);
+    strcpy(e->expected[i], rd.expected[i]);
+  }
+  e->received = s[rd.fail];
+  r->error = e;
+  return 0;
+}
+
+/* Read all of "path", or stdin for "-", then parse it with lval_parse */
+int lval_parse_file(char* path, mpc_result_t* r) {
+
+  int pipe = strcmp(path, "-") == 0;
+  FILE* f = pipe ? stdin : fopen(path, "rb");
+  if (f == NULL) {
+    r->error = lrd_failure(path, "Unable to open file!");
+    return 0;
+  }
+
+  size_t len = 0, cap = 1 << 16;
+  char* s = malloc(cap);
+  size_t n;
+  while ((n = fread(s + len, 1, cap - len - 1, f)) > 0) {
+    len += n;
+    if (cap - len - 1 == 0) { cap *= 2; s = realloc(s, cap); }
+  }
+  s[len] = '\0';
+  if (!pipe) { fclose(f); }
+
+  int ok = lval_parse(pipe ? "<stdin>" : path, s, r);
+  free(s);
+  return ok;
+}
+
+
+// -------------------------------------------------------------------
+// ------------------------  STREAM READER ------------------------------------
+// --------------------------------------------------------------------
+
+
+/*
+ * The stream reader takes input in chunks of any size and hands back
+ * each top level expression as soon as it is complete, so memory is
+ * bounded by the largest single expression rather than the input.
+ *
+ * It only tracks paren depth to find where an expression ends. The
+ * bytes of that expression are then read with lval_parse, so values and
+ * error messages match the hand reader, with positions moved to where
+ * the expression sits in the stream. After an error it carries on with
+ * the next expression.
+ */
+
+typedef void (*lstream_fn)(int ok, mpc_result_t* r, void* data);
+
+typedef struct {
+  char* filename;
+  lstream_fn fn;
+  void* data;
+  char* buf;
+  size_t len;
+  size_t cap;
+  int depth;
+  int errors;
+  mpc_state_t at;    /* position of the next byte */
+  mpc_state_t start; /* position of buf[0] */
+} lstream;
+
+void lstream_init(lstream* st, char* filename, lstream_fn fn, void* data) {
+  memset(st, 0, sizeof(lstream));
+  st->filename = filename;
+  st->fn = fn;
+  st->data = data;
+}
+
+/* Read and hand back everything buffered so far */
+void lstream_flush(lstream* st) {
+  if (st->len == 0) { return; }
+
+  st->buf[st->len] = '\0';
+  st->len = 0;
+  st->depth = 0;
+
+  mpc_result_t r;
+  if (!lval_parse(st->filename, st->buf, &r)) {
+    mpc_err_t* e = r.error;
+    if (e->failure == NULL) {
+      if (e->state.row == 0) { e->state.col += st->start.col; }
+      e->state.row += st->start.row;
+      e->state.pos += st->start.pos;
+    }
+    st->errors++;
+    st->fn(0, &r, st->data);
+    return;
+  }
+
+  lval* v = r.output;
+  for (int i = 0; i < v->count; i++) {
+    r.output = v->cell[i];
+    st->fn(1, &r, st->data);
+  }
+  v->count = 0;
+  lval_del(v);
+}
+
+void lstream_feed(lstream* st, char* s, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    char c = s[i];
+
+    /* Blanks between top level expressions are never buffered */
+    int blank = strchr(" \f\n\r\t\v", c) != NULL;
+    if (st->depth == 0 && blank) {
+      lstream_flush(st);
+    } else {
+      if (st->len == 0) { st->start = st->at; }
+      if (st->len + 2 > st->cap) {
+        st->cap = st->cap ? st->cap * 2 : 256;
+        st->buf = realloc(st->buf, st->cap);
+      }
+      st->buf[st->len++] = c;
+      if (c == '(') { st->depth++; }
+      if (c == ')' && --st->depth <= 0) { lstream_flush(st); }
+    }
+
+    st->at.pos++;
+    if (c == '\n') { st->at.row++; st->at.col = 0; }
+    else { st->at.col++; }
+  }
+}
+
+/* Flush whatever is left at the end of the input, then release it */
+void lstream_end(lstream* st) {
+  lstream_flush(st);
+  free(st->buf);
+  st->buf = NULL;
+  st->cap = 0;
+}
+
+
+// -------------------------------------------------------------------
+// ------------------------  BYTECODE ------------------------------------
+// --------------------------------------------------------------------
+
+
+/*
+ * An expression is compiled once into a flat list of instructions for a
+ * stack machine, then run as many times as needed. Each instruction is
+ * an opcode followed by its operands:
+ *
+ *   OP_CONST k      push a copy of constant "k"
+ *   OP_SEXPR n      pop "n" evaluated items and reduce them as a Sexpr
+ *   OP_BUILTIN f n  pop "n" evaluated arguments and apply builtin "f"
+ *
+ * OP_BUILTIN is used when the head of a Sexpr is a symbol known while
+ * compiling, so it never has to be pushed and checked at run time.
+ */
+enum { OP_CONST, OP_SEXPR, OP_BUILTIN };
+
+typedef struct {
+  int count;
+  int cap;
+  int* code;
+  int consts_count;
+  int consts_cap;
+  lval** consts;
+  /* Deepest the stack gets while running, worked out when compiling */
+  int depth;
+  int max_depth;
+} lcode;
+
+lcode* lcode_new(void) {
+  lcode* c = calloc(1, sizeof(lcode));
+  return c;
+}
+
+void lcode_del(lcode* c) {
+  for (int i = 0; i < c->consts_count; i++) {
+    lval_del(c->consts[i]);
+  }
+  free(c->consts);
+  free(c->code);
+  free(c);
+}
+
+static void lcode_emit(lcode* c, int x) {
+  if (c->count == c->cap) {
+    c->cap = c->cap ? c->cap * 2 : 16;
+    c->code = realloc(c->code, sizeof(int) * c->cap);
+  }
+  c->code[c->count++] = x;
+}
+
+/* Track the stack effect of each instruction to size the stack up front */
+static void lcode_stack(lcode* c, int delta) {
+  c->depth += delta;
+  if (c->depth > c->max_depth) { c->max_depth = c->depth; }
+}
+
+static void lcode_const(lcode* c, lval* v) {
+  if (c->consts_count == c->consts_cap) {
+    c->consts_cap = c->consts_cap ? c->consts_cap * 2 : 8;
+    c->consts = realloc(c->consts, sizeof(lval*) * c->consts_cap);
+  }
+  c->consts[c->consts_count] = lval_copy(v);
+  lcode_emit(c, OP_CONST);
+  lcode_emit(c, c->consts_count++);
+  lcode_stack(c, 1);
+}
+
+/* Compile "v" onto the end of "c". The tree is left untouched. */
+void lval_compile(lcode* c, lval* v) {
+
+  if (lval_type(v) != LVAL_SEXPR) { lcode_const(c, v); return; }
+
+  /* Builtin call with its symbol known up front */
+  if (v->count >= 2 && lval_type(v->cell[0]) == LVAL_SYM) {
+    for (int i = 1; i < v->count; i++) { lval_compile(c, v->cell[i]); }
+    lcode_emit(c, OP_BUILTIN);
+    lcode_emit(c, lval_to_sym(v->cell[0]));
+    lcode_emit(c, v->count - 1);
+    lcode_stack(c, 1 - (v->count - 1));
+    return;
+  }
+
+  for (int i = 0; i < v->count; i++) { lval_compile(c, v->cell[i]); }
+  lcode_emit(c, OP_SEXPR);
+  lcode_emit(c, v->count);
+  lcode_stack(c, 1 - v->count);
+}
+
+/* Reduce the "n" items at "xs" the same way lval_eval_sexpr does */
+static lval* lcode_sexpr(lval** xs, int n) {
+
+  /* Error Checking */
+  for (int i = 0; i < n; i++) {
+    if (lval_type(xs[i]) == LVAL_ERR) { return lval_copy(xs[i]); }
+  }
+
+  /* Empty Expression */
+  if (n == 0) { return lval_sexpr(); }
+
+  /* Single Expression */
+  if (n == 1) { return lval_copy(xs[0]); }
+
+  /* Ensure First Element is Symbol */
+  if (lval_type(xs[0]) != LVAL_SYM) {
+    return lval_err("S-expression Does not start with symbol.");
+  }
+
+  return builtin_apply(xs + 1, n - 1, lval_to_sym(xs[0]));
+}
+
+static lval* lcode_builtin(lval** xs, int n, int op) {
+  for (int i = 0; i < n; i++) {
+    if (lval_type(xs[i]) == LVAL_ERR) { return lval_copy(xs[i]); }
+  }
+  return builtin_apply(xs, n, op);
+}
+
+lval* lcode_run(lcode* c) {
+
+  lval** stack = malloc(sizeof(lval*) * (c->max_depth + 1));
+  int top = 0;
+
+  int pc = 0;
+  while (pc < c->count) {
+    switch (c->code[pc]) {
+
+      case OP_CONST:
+        stack[top++] = lval_copy(c->consts[c->code[pc+1]]);
+        pc += 2;
+      break;
+
+      case OP_SEXPR: {
+        int n = c->code[pc+1];
+        lval* x = lcode_sexpr(stack + top - n, n);
+        for (int i = top - n; i < top; i++) { lval_del(stack[i]); }
+        top -= n;
+        stack[top++] = x;
+        pc += 2;
+      } break;
+
+      case OP_BUILTIN: {
+        int n = c->code[pc+2];
+        lval* x = lcode_builtin(stack + top - n, n, c->code[pc+1]);
+        for (int i = top - n; i < top; i++) { lval_del(stack[i]); }
+        top -= n;
+        stack[top++] = x;
+        pc += 3;
+      } break;
+    }
+  }
+
+  /* A whole input compiles to a single value left on the stack */
+  lval* x = stack[0];
+  free(stack);
+  return x;
+}
+
+/*
+ * Top level forms that come round again are compiled once and their code
+ * kept, so every later repeat just runs it. A form seen for the first time
+ * is walked with lval_eval, and only its hash is remembered.
+ *
+ * The key is a flat encoding of the tree in prefix order: tagged leaves
+ * as their raw bits, and each Sexpr as its count shifted clear of the tag
+ * bits. Forms with heap leaves, and code holding heap constants, are not
+ * cached, so the cache never keeps pool nodes live between evaluations.
+ */
+enum { LCACHE_SLOTS = 1024 };
+
+typedef struct {
+  unsigned long hash;
+  int key_len;
+  uintptr_t* key;
+  /* NULL until the form has been seen a second time */
+  lcode* code;
+} lcache_slot;
+
+static lcache_slot lcache[LCACHE_SLOTS];
+
+/* Encoding of the form being looked up */
+static uintptr_t* lcache_key;
+static int lcache_key_len;
+static int lcache_key_cap;
+
+static int lcache_encode(lval* v) {
+
+  if (lcache_key_len == lcache_key_cap) {
+    lcache_key_cap = lcache_key_cap ? lcache_key_cap * 2 : 64;
+    lcache_key = realloc(lcache_key, sizeof(uintptr_t) * lcache_key_cap);
+  }
+
+  if (lval_type(v) != LVAL_SEXPR) {
+    if (lval_is_heap(v)) { return 0; }
+    lcache_key[lcache_key_len++] = (uintptr_t)v;
+    return 1;
+  }
+
+  lcache_key[lcache_key_len++] = (uintptr_t)v->count << 2;
+  for (int i = 0; i < v->count; i++) {
+    if (!lcache_encode(v->cell[i])) { return 0; }
+  }
+  return 1;
+}
+
+static unsigned long lcache_hash(void) {
+  unsigned long h = 2166136261UL;
+  for (int i = 0; i < lcache_key_len; i++) {
+    h = (h ^ lcache_key[i]) * 16777619UL;
+  }
+  return h;
+}
+
+static int lcode_pins(lcode* c) {
+  for (int i = 0; i < c->consts_count; i++) {
+    if (lval_is_heap(c->consts[i])) { return 1; }
+  }
+  return 0;
+}
+
+/* Evaluate "v", taking ownership of it, reusing code compiled for it
+   earlier when there is some */
+lval* lcache_eval(lval* v) {
+
+  lcache_key_len = 0;
+  if (!lcache_encode(v)) { return lval_eval(v); }
+
+  unsigned long h = lcache_hash();
+  lcache_slot* s = &lcache[h % LCACHE_SLOTS];
+
+  if (s->code && s->hash == h && s->key_len == lcache_key_len
+    && memcmp(s->key, lcache_key, sizeof(uintptr_t) * lcache_key_len) == 0) {
+    lval_del(v);
+    return lcode_run(s->code);
+  }
+
+  /* First sighting, or another form has the slot: note it and walk it */
+  if (s->hash != h || s->code) {
+    if (s->code) { lcode_del(s->code); }
+    free(s->key);
+    s->hash = h;
+    s->key_len = 0;
+    s->key = NULL;
+    s->code = NULL;
+    return lval_eval(v);
+  }
+
+  /* Seen before, so fold and compile it for this run and the next ones */
+  lval* t = lval_fold(v);
+  lcode* c = lcode_new();
+  lval_compile(c, t);
+  lval_del(t);
+
+  lval* x = lcode_run(c);
+  if (lcode_pins(c)) { lcode_del(c); return x; }
+
+  s->key_len = lcache_key_len;
+  s->key = malloc(sizeof(uintptr_t) * lcache_key_len);
+  memcpy(s->key, lcache_key, sizeof(uintptr_t) * lcache_key_len);
+  s->code = c;
+  return x;
+}
+
+
+// -------------------------------------------------------------------
+// ------------------------  DRIVER ------------------------------------
 // --------------------------------------------------------------------
 
 
+/* Front ends that turn input text into lvals */
+enum { READ_AST, READ_DIRECT, READ_HAND, READ_STREAM };
+
+/* Evaluate a freshly read expression, taking ownership of it */
+lval* lval_eval_top(lval* v) {
+  if (lpar_threads) {
+    /* Walk the tree, splitting large Sexprs across the threads */
+    return lval_eval_par(v);
+  }
+
+  /* Walk new forms, and run the kept bytecode for repeated ones */
+  return lcache_eval(v);
+}
+
+/* Print and release a result, then reset the arena */
+void lval_emit(lval* x, int stats) {
+  lval_println(x);
+  lval_del(x);
+
+  /* Everything from this evaluation is released, reset the arena */
+  lval_pool_reset();
+  if (stats) { lval_pool_stats(); }
+}
+
+void lval_stream_emit(int ok, mpc_result_t* r, void* stats) {
+  if (ok) {
+    lval_emit(lval_eval_top(r->output), *(int*)stats);
+  } else {
+    mpc_err_print(r->error);
+    mpc_err_delete(r->error);
+  }
+}
+
+/* Evaluate each expression of a file as soon as it has been read */
+int lval_stream(char* path, int stats) {
+
+  int pipe = strcmp(path, "-") == 0;
+  FILE* f = pipe ? stdin : fopen(path, "rb");
+  if (f == NULL) {
+    mpc_err_t* e = lrd_failure(path, "Unable to open file!");
+    mpc_err_print(e);
+    mpc_err_delete(e);
+    return 1;
+  }
+
+  setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+  lstream st;
+  lstream_init(&st, pipe ? "<stdin>" : path, lval_stream_emit, &stats);
+
+  char chunk[1 << 16];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    lstream_feed(&st, chunk, n);
+  }
+  lstream_end(&st);
+
+  if (!pipe) { fclose(f); }
+  fflush(stdout);
+  return st.errors ? 1 : 0;
+}
+
+/*
+ * Batch mode parses a whole file (or stdin for "-") in a single call and
+ * evaluates each top level expression in turn. Output is fully buffered,
+ * so results only reach the terminal in large writes.
+ */
+int lval_batch(mpc_parser_t* lispy, char* path, int reader, int stats) {
+
+  if (reader == READ_STREAM) { return lval_stream(path, stats); }
+
+  mpc_result_t r;
+  int ok = reader == READ_HAND ? lval_parse_file(path, &r)
+    : strcmp(path, "-") == 0
+    ? mpc_parse_pipe("<stdin>", stdin, lispy, &r)
+    : mpc_parse_contents(path, lispy, &r);
+
+  if (!ok) {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return 1;
+  }
+
+  setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+
+  /* The other readers already give a Sexpr of every expression */
+  if (reader != READ_AST) {
+    lval* v = r.output;
+    for (int i = 0; i < v->count; i++) {
+      lval_emit(lval_eval_top(v->cell[i]), stats);
+    }
+    v->count = 0;
+    lval_del(v);
+    fflush(stdout);
+    return 0;
+  }
+
+  mpc_ast_t* t = r.output;
+  for (int i = 0; i < t->children_num; i++) {
+    if (t->children[i]->id == 0) { continue; }
+    lval_emit(lval_eval_top(lval_read(t->children[i])), stats);
+  }
+
+  fflush(stdout);
+  mpc_ast_delete(r.output);
+  return 0;
+}
+
 int main(int argc, char** argv) {
 
+  /* Print pool usage after every evaluation with --stats */
+  int stats = 0;
+
+  /* Evaluate a file, or stdin for "-", instead of starting the REPL */
+  char* batch = NULL;
+
+  /* Read lvals straight from the parser with --direct, skipping the
+     AST, or with the hand written reader with --hand. In batch mode
+     --stream reads one expression at a time instead of the whole file */
+  int reader = READ_AST;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--stats") == 0)   { stats = 1; continue; }
+    if (strcmp(argv[i], "--direct") == 0)  { reader = READ_DIRECT; continue; }
+    if (strcmp(argv[i], "--hand") == 0)    { reader = READ_HAND; continue; }
+    if (strcmp(argv[i], "--stream") == 0)  { reader = READ_STREAM; continue; }
+    if (strcmp(argv[i], "--checked") == 0) { lval_checked = 1; continue; }
+    if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      int n = atoi(argv[++i]);
+      if (n > 1) { lpar_init(n); }
+      continue;
+    }
+    batch = argv[i];
+  }
+
+  lval_sum_init();
+
   mpc_parser_t* Number = mpc_new("number");
   mpc_parser_t* Symbol = mpc_new("symbol");
   mpc_parser_t* Sexpr  = mpc_new("sexpr");
   mpc_parser_t* Expr   = mpc_new("expr");
   mpc_parser_t* Lispy  = mpc_new("lispy");
 
+  sym_init();
+
   mpca_lang(MPCA_LANG_DEFAULT,
     "                                          \
       number : /-?[0-9]+/ ;                    \
@@ -322,20 +1980,39 @@ int main(int argc, char** argv) {
     ",
     Number, Symbol, Sexpr, Expr, Lispy);
 
+  mpc_parser_t* Term = mpc_new("expr");
+  mpc_parser_t* Line = lval_reader(Term);
+  mpc_parser_t* Top  = reader == READ_DIRECT ? Line : Lispy;
+
+  if (batch) {
+    int status = lval_batch(Top, batch, reader, stats);
+    mpc_cleanup(7, Number, Symbol, Sexpr, Expr, Lispy, Term, Line);
+    return status;
+  }
+
   puts("Lispy Version 0.0.0.0.5");
   puts("Press Ctrl+c to Exit\n");
 
+  /* Reused by every line so the parser's scratch memory is allocated once */
+  mpc_context_t* ctx = mpc_context_new(0);
+
   while (1) {
 
     char* input = readline("lispy> ");
     add_history(input);
 
     mpc_result_t r;
-    if (mpc_parse("<stdin>", input, Lispy, &r)) {
-      lval* x = lval_eval(lval_read(r.output));
-      lval_println(x);
-      lval_del(x);
-      mpc_ast_delete(r.output);
+    int ok = reader == READ_HAND || reader == READ_STREAM
+      ? lval_parse("<stdin>", input, &r)
+      : mpc_parse_ctx(ctx, "<stdin>", input, Top, &r);
+
+    if (ok) {
+      if (reader != READ_AST) {
+        lval_emit(lval_eval_top(r.output), stats);
+      } else {
+        lval_emit(lval_eval_top(lval_read(r.output)), stats);
+        mpc_ast_delete(r.output);
+      }
     } else {
       mpc_err_print(r.error);
       mpc_err_delete(r.error);
@@ -345,7 +2022,8 @@ int main(int argc, char** argv) {
 
   }
 
-  mpc_cleanup(5, Number, Symbol, Sexpr, Expr, Lispy);
+  mpc_context_delete(ctx);
+  mpc_cleanup(7, Number, Symbol, Sexpr, Expr, Lispy, Term, Line);
 
   return 0;
 }